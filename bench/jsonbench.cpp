@@ -0,0 +1,411 @@
+// Throughput benchmarks over a generated corpus.
+//
+//   g++ -O2 -std=c++17 -pthread -Iinclude bench/jsonbench.cpp -o jsonbench
+//   ./jsonbench [--size MiB] [--reps N] [--dir corpusDir] [--out results.json]
+//
+// Writes one corpus file per shape and size into --dir (reused if already
+// there), runs every benchmark on each and prints a table. Results also go to
+// --out as a JSON array of {shape, benchmark, bytes, tokens, seconds,
+// mbPerSec, nsPerToken, allocsPerDoc} records, one per line, for comparing
+// runs.
+#include "json.hpp"
+#include "jsonfmt.hpp"
+#include "jsonindex.hpp"
+#include "jsontok.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+// Every allocation in the process is counted, so a benchmark's figure is the
+// difference across one run of it. The replacements are kept out of line so
+// the compiler does not pair the inlined malloc/free with new/delete.
+static std::atomic<size_t> allocationCount{0};
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+    // Corpus generation. Each shape writes records into one top-level array
+    // until the target size is reached; the seed is fixed so runs compare.
+    class CorpusWriter {
+    private:
+        std::mt19937_64 rng{42};
+        std::string out;
+
+        static const char* word(size_t i) {
+            static const char* words[] = {
+                "lorem", "ipsum", "dolor", "sit", "amet", "json", "parser", "token",
+                "stream", "value", "quote\\\"d", "tab\\t", "caf\\u00e9", "emoji \xF0\x9F\x98\x80",
+                "release", "network"
+            };
+            return words[i % (sizeof(words) / sizeof(words[0]))];
+        }
+
+    public:
+        uint64_t next(uint64_t bound) {
+            return rng() % bound;
+        }
+
+        double uniform(double low, double high) {
+            return std::uniform_real_distribution<double>(low, high)(rng);
+        }
+
+        void raw(const std::string& text) {
+            out += text;
+        }
+
+        void text(size_t words) {
+            out += '"';
+            for (size_t i = 0; i < words; i++) {
+                if (i > 0)
+                    out += ' ';
+                out += word(next(1000));
+            }
+            out += '"';
+        }
+
+        void number(double value, int precision) {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.*f", precision, value);
+            out += buffer;
+        }
+
+        void integer(uint64_t value) {
+            out += std::to_string(value);
+        }
+
+        size_t size() const {
+            return out.size();
+        }
+
+        const std::string& str() const {
+            return out;
+        }
+    };
+
+    void tweet(CorpusWriter& w, size_t id) {
+        w.raw("{\"id\":");
+        w.integer(1000000000000000000ull + id);
+        w.raw(",\"created_at\":\"2024-05-0");
+        w.integer(1 + w.next(9));
+        w.raw("T12:00:00Z\",\"text\":");
+        w.text(8 + w.next(20));
+        w.raw(",\"user\":{\"id\":");
+        w.integer(w.next(100000000));
+        w.raw(",\"screen_name\":");
+        w.text(1);
+        w.raw(",\"followers_count\":");
+        w.integer(w.next(1000000));
+        w.raw(",\"verified\":");
+        w.raw(w.next(10) == 0 ? "true" : "false");
+        w.raw("},\"entities\":{\"hashtags\":[");
+        for (uint64_t i = 0, n = w.next(4); i < n; i++) {
+            w.raw(i > 0 ? ",{\"text\":" : "{\"text\":");
+            w.text(1);
+            w.raw(",\"indices\":[");
+            w.integer(w.next(100));
+            w.raw(",");
+            w.integer(w.next(140));
+            w.raw("]}");
+        }
+        w.raw("]},\"retweet_count\":");
+        w.integer(w.next(5000));
+        w.raw(",\"in_reply_to\":null,\"lang\":\"en\"}");
+    }
+
+    void coordinates(CorpusWriter& w, size_t) {
+        w.raw("{\"type\":\"LineString\",\"coordinates\":[");
+        for (int i = 0; i < 64; i++) {
+            w.raw(i > 0 ? ",[" : "[");
+            w.number(w.uniform(-180, 180), 6);
+            w.raw(",");
+            w.number(w.uniform(-90, 90), 6);
+            w.raw(",");
+            w.number(w.uniform(0, 4000), 1);
+            w.raw("]");
+        }
+        w.raw("]}");
+    }
+
+    void nestedLevel(CorpusWriter& w, int depth) {
+        if (depth == 0) {
+            w.raw("{\"enabled\":true,\"limit\":");
+            w.integer(w.next(1000));
+            w.raw(",\"name\":");
+            w.text(2);
+            w.raw("}");
+            return;
+        }
+        w.raw("{\"level\":");
+        w.integer(depth);
+        w.raw(",\"children\":[");
+        nestedLevel(w, depth - 1);
+        w.raw(",[[");
+        w.integer(depth);
+        w.raw("]]],\"options\":");
+        nestedLevel(w, depth - 1 > 2 ? 2 : depth - 1);
+        w.raw("}");
+    }
+
+    void nested(CorpusWriter& w, size_t) {
+        nestedLevel(w, 24);
+    }
+
+    void longStrings(CorpusWriter& w, size_t id) {
+        w.raw("{\"id\":");
+        w.integer(id);
+        w.raw(",\"body\":");
+        w.text(2000 + w.next(2000));
+        w.raw("}");
+    }
+
+    void wide(CorpusWriter& w, size_t) {
+        w.raw("{");
+        for (int i = 0; i < 500; i++) {
+            w.raw(i > 0 ? ",\"field_" : "\"field_");
+            w.integer(i);
+            w.raw("\":");
+            switch (w.next(4)) {
+                case 0: w.integer(w.next(1 << 30)); break;
+                case 1: w.number(w.uniform(0, 1), 4); break;
+                case 2: w.text(1); break;
+                default: w.raw("null");
+            }
+        }
+        w.raw("}");
+    }
+
+    struct Shape {
+        const char* name;
+        void (*record)(CorpusWriter&, size_t);
+    };
+
+    const Shape shapes[] = {
+        {"tweets", tweet},
+        {"coordinates", coordinates},
+        {"nested", nested},
+        {"longstrings", longStrings},
+        {"wide", wide},
+    };
+
+    bool fileExists(const std::string& path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && st.st_size > 0;
+    }
+
+    std::string generate(const Shape& shape, const std::string& dir, size_t sizeMiB) {
+        std::string path = dir + "/" + shape.name + "-" + std::to_string(sizeMiB) + "m.json";
+        size_t targetBytes = sizeMiB << 20;
+        if (fileExists(path))
+            return path;
+        CorpusWriter w;
+        w.raw("[\n");
+        for (size_t id = 0; w.size() < targetBytes; id++) {
+            if (id > 0)
+                w.raw(",\n");
+            shape.record(w, id);
+        }
+        w.raw("\n]\n");
+        std::ofstream file(path, std::ios::binary);
+        file.write(w.str().data(), w.str().size());
+        if (!file)
+            throw std::runtime_error("Failed to write corpus file: " + path);
+        return path;
+    }
+
+    size_t fileSize(const std::string& path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+    }
+
+    size_t countTokens(const std::string& path) {
+        jsontok::JsonOnDemandTokenizer tokenizer(path);
+        size_t count = 0;
+        while (tokenizer.getNextToken().getTokenType() != jsontok::TokenType::END_OF_FILE)
+            count++;
+        return count;
+    }
+
+    // Reads every value through the json::Json interface: keys come from the
+    // tree, each lookup and conversion goes through operator[] and the as*
+    // accessors.
+    double walk(const json::Json& value) {
+        double sum = 0;
+        if (value.isObject()) {
+            for (const auto& pair : std::static_pointer_cast<jsonparse::JsonObject>(value.raw())->getKeyPairs())
+                sum += walk(value[pair.first]);
+        }
+        else if (value.isArray()) {
+            for (size_t i = 0, n = value.arraySize(); i < n; i++)
+                sum += walk(value[i]);
+        }
+        else if (value.isNumber()) {
+            sum += value.asDouble();
+        }
+        else if (value.isString()) {
+            sum += static_cast<double>(value.asString().size());
+        }
+        else if (value.isBool()) {
+            sum += value.asBool() ? 1 : 0;
+        }
+        return sum;
+    }
+
+    struct Result {
+        std::string shape;
+        std::string benchmark;
+        size_t bytes;
+        size_t tokens;
+        double seconds;
+        size_t allocations;
+    };
+
+    // Best of reps runs; the allocation count is from the first.
+    Result measure(const std::string& shape, const std::string& benchmark, size_t bytes, size_t tokens,
+                   int reps, const std::function<void()>& run) {
+        Result result{shape, benchmark, bytes, tokens, 0, 0};
+        for (int rep = 0; rep < reps; rep++) {
+            size_t allocationsBefore = allocationCount.load();
+            auto start = std::chrono::steady_clock::now();
+            run();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (rep == 0) {
+                result.allocations = allocationCount.load() - allocationsBefore;
+                result.seconds = seconds;
+            }
+            else if (seconds < result.seconds) {
+                result.seconds = seconds;
+            }
+        }
+        return result;
+    }
+
+    double mbPerSec(const Result& r) {
+        return r.seconds > 0 ? r.bytes / r.seconds / (1 << 20) : 0;
+    }
+
+    double nsPerToken(const Result& r) {
+        return r.tokens > 0 ? r.seconds * 1e9 / r.tokens : 0;
+    }
+
+    void writeResults(const std::vector<Result>& results, const std::string& path) {
+        std::FILE* file = std::fopen(path.c_str(), "w");
+        if (file == nullptr)
+            throw std::runtime_error("Failed to open file: " + path);
+        std::fprintf(file, "[\n");
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            std::fprintf(file,
+                         "{\"shape\":\"%s\",\"benchmark\":\"%s\",\"bytes\":%zu,\"tokens\":%zu,"
+                         "\"seconds\":%.6f,\"mbPerSec\":%.2f,\"nsPerToken\":%.2f,\"allocsPerDoc\":%zu}%s\n",
+                         r.shape.c_str(), r.benchmark.c_str(), r.bytes, r.tokens, r.seconds,
+                         mbPerSec(r), nsPerToken(r), r.allocations, i + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(file, "]\n");
+        std::fclose(file);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t sizeMiB = 16;
+    int reps = 3;
+    std::string dir = "bench-corpus";
+    std::string outFile = "bench-results.json";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag == "--size")
+            sizeMiB = std::strtoul(argv[i + 1], nullptr, 10);
+        else if (flag == "--reps")
+            reps = std::max(1, std::atoi(argv[i + 1]));
+        else if (flag == "--dir")
+            dir = argv[i + 1];
+        else if (flag == "--out")
+            outFile = argv[i + 1];
+        else {
+            std::fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    mkdir(dir.c_str(), 0755);
+    std::string scratch = dir + "/out.json";
+
+    std::vector<Result> results;
+    std::printf("%-12s %-22s %10s %10s %12s\n", "shape", "benchmark", "MB/s", "ns/token", "allocs/doc");
+    for (const Shape& shape : shapes) {
+        std::string path = generate(shape, dir, sizeMiB);
+        size_t bytes = fileSize(path);
+        size_t tokens = countTokens(path);
+        std::vector<Result> shapeResults;
+
+        shapeResults.push_back(measure(shape.name, "formatJson", bytes, tokens, reps, [&]() {
+            jsonfmt::JsonFormat(path, scratch).formatJson(4);
+        }));
+        shapeResults.push_back(measure(shape.name, "minifyJson", bytes, tokens, reps, [&]() {
+            jsonfmt::JsonFormat(path, scratch).minifyJson();
+        }));
+        shapeResults.push_back(measure(shape.name, "JsonStreamTokenizer", bytes, tokens, reps, [&]() {
+            jsontok::JsonStreamTokenizer tokenizer(path);
+            tokenizer.startTokenizing();
+        }));
+        shapeResults.push_back(measure(shape.name, "JsonOnDemandTokenizer", bytes, tokens, reps, [&]() {
+            jsontok::JsonOnDemandTokenizer tokenizer(path);
+            while (tokenizer.getNextToken().getTokenType() != jsontok::TokenType::END_OF_FILE) {
+            }
+        }));
+        shapeResults.push_back(measure(shape.name, "StructuralIndex", bytes, tokens, reps, [&]() {
+            fileutils::InputFileReader reader(path);
+            jsonindex::StructuralIndex index(reader.wholeInput());
+        }));
+        shapeResults.push_back(measure(shape.name, "JsonParser", bytes, tokens, reps, [&]() {
+            json::Json document(path);
+        }));
+        shapeResults.push_back(measure(shape.name, "parseParallel", bytes, tokens, reps, [&]() {
+            json::parseParallel(path);
+        }));
+        shapeResults.push_back(measure(shape.name, "Json::loadArena", bytes, tokens, reps, [&]() {
+            json::Json::loadArena(path);
+        }));
+        std::string snapshot = dir + "/" + shape.name + ".snap";
+        json::Json::loadArena(path).saveSnapshot(snapshot);
+        shapeResults.push_back(measure(shape.name, "Json::openSnapshot", bytes, tokens, reps, [&]() {
+            json::Json::openSnapshot(snapshot);
+        }));
+        std::remove(snapshot.c_str());
+        json::Json document(path);
+        volatile double sink = 0;
+        shapeResults.push_back(measure(shape.name, "Json access", bytes, tokens, reps, [&]() {
+            sink = sink + walk(document);
+        }));
+
+        for (const Result& r : shapeResults) {
+            std::printf("%-12s %-22s %10.1f %10.2f %12zu\n", r.shape.c_str(), r.benchmark.c_str(),
+                        mbPerSec(r), nsPerToken(r), r.allocations);
+            results.push_back(r);
+        }
+    }
+    std::remove(scratch.c_str());
+    writeResults(results, outFile);
+    std::printf("results written to %s\n", outFile.c_str());
+    return 0;
+}
@@ -1,12 +1,32 @@
 #pragma once
 
+#include "jsonstats.hpp"
 #include<string>
+#include<string_view>
 #include<fstream>
 #include<iostream>
 #include<vector>
+#include<stdexcept>
+#include<cstring>
+#include<cstdint>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+#define FILEUTILS_HAS_MMAP 1
+#endif
 
 namespace fileutils{
 
+    // Buffered file output with write-behind: a full 1 MiB buffer is handed
+    // to a background thread and filling continues in a second one, so
+    // formatting is not held up by a slow disk. The thread starts with the
+    // first full buffer; smaller outputs are written inline by flush().
     class OutputFileWriter{
         private:
             static const std::size_t BUFFER_SIZE = 1 << 20;
@@ -14,13 +34,68 @@ namespace fileutils{
             size_t bytesPushed = 0;
             std::ofstream file;
 
+            std::vector<char> pendingBuffer;
+            size_t pendingBytes = 0;
+            std::thread writer;
+            std::mutex lock;
+            std::condition_variable changed;
+            bool stopping = false;
+
+            void writerLoop(){
+                std::unique_lock<std::mutex> guard(lock);
+                while(true){
+                    changed.wait(guard, [&](){ return pendingBytes > 0 || stopping; });
+                    if(pendingBytes == 0){
+                        return;
+                    }
+                    guard.unlock();
+                    file.write(pendingBuffer.data(), pendingBytes);
+                    guard.lock();
+                    pendingBytes = 0;
+                    changed.notify_all();
+                }
+            }
+
+            // Blocks until the background write, if any, is done; the file
+            // is then ours to write directly.
+            void waitForWriter(){
+                if(writer.joinable()){
+                    std::unique_lock<std::mutex> guard(lock);
+                    changed.wait(guard, [&](){ return pendingBytes == 0; });
+                }
+            }
+
+            // Waits even with nothing pushed: a buffer that just filled up
+            // may still be on its way out in the background.
             void writeToFile(){
+                waitForWriter();
                 if(bytesPushed > 0){
+                    JSONSTATS_PHASE(WRITE);
+                    JSONSTATS_ADD(bytesWritten, bytesPushed);
+                    JSONSTATS_ADD(chunksWritten, 1);
                     file.write(outPutBuffer.data(),bytesPushed);
                     bytesPushed = 0;
                 }
             }
 
+            // Passes the full buffer to the writer thread and carries on in
+            // the one it last finished with.
+            void writeBehind(){
+                JSONSTATS_PHASE(WRITE);
+                JSONSTATS_ADD(bytesWritten, bytesPushed);
+                JSONSTATS_ADD(chunksWritten, 1);
+                if(!writer.joinable()){
+                    pendingBuffer.resize(BUFFER_SIZE);
+                    writer = std::thread([this](){ writerLoop(); });
+                }
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&](){ return pendingBytes == 0; });
+                outPutBuffer.swap(pendingBuffer);
+                pendingBytes = bytesPushed;
+                bytesPushed = 0;
+                changed.notify_all();
+            }
+
         public:
             OutputFileWriter(std::string fileName){
                 file.open(fileName,std::ios::binary);
@@ -31,72 +106,500 @@ namespace fileutils{
             void pushChar(char nextChar){
                 outPutBuffer[bytesPushed++] = nextChar;
                 if(bytesPushed == BUFFER_SIZE){
-                    flush();
+                    writeBehind();
                 } 
             }
 
+            void write(const char* data, size_t len){
+                if(bytesPushed + len > BUFFER_SIZE){
+                    if(len >= BUFFER_SIZE){
+                        // flush() leaves the writer thread idle, so the
+                        // stream is ours alone for the direct write.
+                        flush();
+                        JSONSTATS_PHASE(WRITE);
+                        JSONSTATS_ADD(bytesWritten, len);
+                        JSONSTATS_ADD(chunksWritten, 1);
+                        file.write(data, len);
+                        return;
+                    }
+                    writeBehind();
+                }
+                std::memcpy(outPutBuffer.data() + bytesPushed, data, len);
+                bytesPushed += len;
+                if(bytesPushed == BUFFER_SIZE){
+                    writeBehind();
+                }
+            }
+
+            void write(std::string_view text){
+                write(text.data(), text.size());
+            }
+
+            // Everything pushed so far has reached the stream when this returns.
             void flush(){
                 writeToFile();
             }
 
             ~OutputFileWriter(){
                 flush();
+                if(writer.joinable()){
+                    {
+                        std::lock_guard<std::mutex> guard(lock);
+                        stopping = true;
+                    }
+                    changed.notify_all();
+                    writer.join();
+                }
                 if(file.is_open()){
                     file.close();
                 }
             }
     };
 
+    // In-memory counterpart of OutputFileWriter: same pushChar/write surface,
+    // appending to a caller-owned string.
+    class BufferWriter{
+        private:
+            std::string& out;
+
+        public:
+            BufferWriter(std::string& target) : out(target){}
+
+            void pushChar(char nextChar){
+                out.push_back(nextChar);
+            }
+
+            void write(const char* data, size_t len){
+                out.append(data, len);
+            }
+
+            void write(std::string_view text){
+                out.append(text.data(), text.size());
+            }
+
+            void flush(){}
+    };
+
+    // What tells one version of a file from another without reading it.
+    struct FileIdentity{
+        uint64_t device = 0;
+        uint64_t inode = 0;
+        uint64_t size = 0;
+        int64_t modifiedNanos = 0;
+
+        bool operator==(const FileIdentity& other) const{
+            return device == other.device && inode == other.inode && size == other.size &&
+                   modifiedNanos == other.modifiedNanos;
+        }
+
+        bool operator!=(const FileIdentity& other) const{
+            return !(*this == other);
+        }
+    };
+
+    // Fills identity for a regular file; false if there is none or the
+    // platform cannot tell.
+    inline bool fileIdentity(const std::string& fileName, FileIdentity& identity){
+#ifdef FILEUTILS_HAS_MMAP
+        struct stat st;
+        if(stat(fileName.c_str(), &st) != 0 || !S_ISREG(st.st_mode)){
+            return false;
+        }
+#ifdef __APPLE__
+        const struct timespec& modified = st.st_mtimespec;
+#else
+        const struct timespec& modified = st.st_mtim;
+#endif
+        identity.device = static_cast<uint64_t>(st.st_dev);
+        identity.inode = static_cast<uint64_t>(st.st_ino);
+        identity.size = static_cast<uint64_t>(st.st_size);
+        identity.modifiedNanos = static_cast<int64_t>(modified.tv_sec) * 1000000000 + modified.tv_nsec;
+        return true;
+#else
+        (void)fileName;
+        (void)identity;
+        return false;
+#endif
+    }
+
+    // Read-only memory mapping of a whole regular file. open() fails softly
+    // (returns false) for pipes, sockets, empty files or platforms without mmap
+    // so callers can fall back to buffered reads.
+    class MappedFile{
+        private:
+            const char* mappedData = nullptr;
+            size_t mappedSize = 0;
+
+            void unmap(){
+#ifdef FILEUTILS_HAS_MMAP
+                if(mappedData != nullptr){
+                    munmap(const_cast<char*>(mappedData), mappedSize);
+                }
+#endif
+                mappedData = nullptr;
+                mappedSize = 0;
+            }
+
+        public:
+            MappedFile(){}
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            bool open(const std::string& fileName){
+                unmap();
+#ifdef FILEUTILS_HAS_MMAP
+                int fd = ::open(fileName.c_str(), O_RDONLY);
+                if(fd < 0){
+                    return false;
+                }
+                struct stat st;
+                if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0){
+                    ::close(fd);
+                    return false;
+                }
+#ifdef POSIX_FADV_SEQUENTIAL
+                posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+                void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                ::close(fd);
+                if(addr == MAP_FAILED){
+                    return false;
+                }
+                madvise(addr, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+                mappedData = static_cast<const char*>(addr);
+                mappedSize = static_cast<size_t>(st.st_size);
+                return true;
+#else
+                (void)fileName;
+                return false;
+#endif
+            }
+
+            bool isMapped() const{
+                return mappedData != nullptr;
+            }
+
+            const char* data() const{
+                return mappedData;
+            }
+
+            size_t size() const{
+                return mappedSize;
+            }
+
+            ~MappedFile(){
+                unmap();
+            }
+    };
+
+    // Reads a file either straight out of a memory mapping (regular files) or
+    // through a 1 MiB buffer (pipes, character devices, or when mmap is disabled).
+    // Both modes expose the same window: readNextChar() for byte-at-a-time
+    // consumers, currentChunk()/advance() for consumers that scan in bulk.
+    //
+    // Buffered input longer than one chunk is read ahead: a background thread
+    // loads the next chunk into a second buffer while the current one is
+    // consumed, so the disk and the tokenizer work at the same time.
     class InputFileReader{
         private:
             static const std::size_t BUFFER_SIZE = 1 << 20;
-            std::vector<char> textChunk = std::vector<char>(BUFFER_SIZE);;
+            MappedFile mapped;
+            std::vector<char> textChunk;
             std::ifstream file;
+            const char* window = nullptr;
             size_t bytesReadFromBuffer = 0;
             size_t bytesReadFromFile = 0;
             int eof = 0;
+            bool inMemory = false;
+            size_t openSize = 0;
 
-            void updateBytesLeft(){
-                std::streamsize bytesRead = file.gcount();
+            std::vector<char> aheadChunk;
+            size_t aheadBytes = 0;
+            bool aheadReady = false;
+            bool aheadDone = false;
+            std::thread reader;
+            std::mutex lock;
+            std::condition_variable changed;
+            bool stopping = false;
+
+            void updateBytesLeft(size_t bytesRead){
+                JSONSTATS_ADD(bytesRead, bytesRead);
+                JSONSTATS_ADD(chunksRead, bytesRead != 0 ? 1 : 0);
                 if(bytesRead != 0){
                     bytesReadFromBuffer = bytesRead;
                 }
                 else{
+                    bytesReadFromBuffer = 0;
                     eof = 1;
                 }
             }
 
+            // Fills aheadChunk whenever the consumer has taken the last one,
+            // until a short read marks the end of the file.
+            void readerLoop(){
+                std::unique_lock<std::mutex> guard(lock);
+                while(true){
+                    changed.wait(guard, [&](){ return !aheadReady || stopping; });
+                    if(stopping){
+                        return;
+                    }
+                    guard.unlock();
+                    file.read(aheadChunk.data(), BUFFER_SIZE);
+                    size_t bytesRead = static_cast<size_t>(file.gcount());
+                    guard.lock();
+                    aheadBytes = bytesRead;
+                    aheadReady = true;
+                    aheadDone = bytesRead < BUFFER_SIZE;
+                    changed.notify_all();
+                    if(aheadDone){
+                        return;
+                    }
+                }
+            }
+
             void readNextChunk(){
-                file.read(textChunk.data(),BUFFER_SIZE);
-                updateBytesLeft();
+                JSONSTATS_PHASE(READ);
+                if(!reader.joinable()){
+                    file.read(textChunk.data(),BUFFER_SIZE);
+                    updateBytesLeft(static_cast<size_t>(file.gcount()));
+                    return;
+                }
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&](){ return aheadReady || aheadDone; });
+                if(!aheadReady){
+                    updateBytesLeft(0);
+                    return;
+                }
+                textChunk.swap(aheadChunk);
+                window = textChunk.data();
+                aheadReady = false;
+                updateBytesLeft(aheadBytes);
+                changed.notify_all();
+            }
+
+            bool refill(){
+                if(mapped.isMapped() || inMemory || eof == 1){
+                    eof = 1;
+                    return false;
+                }
+                readNextChunk();
+                bytesReadFromFile = 0;
+                return eof == 0;
             }
 
         public:
-            InputFileReader(std::string fileName){
+            InputFileReader(std::string fileName, bool allowMmap = true){
+                if(allowMmap && mapped.open(fileName)){
+                    JSONSTATS_ADD(bytesRead, mapped.size());
+                    JSONSTATS_ADD(chunksRead, 1);
+                    window = mapped.data();
+                    bytesReadFromBuffer = mapped.size();
+                    return;
+                }
                 file.open(fileName, std::ios::binary);
                 if(!file.is_open()){
                     throw std::runtime_error("Failed to open file: " + fileName);
                 }
+                // Regular files report their size; pipes fail to seek.
+                file.seekg(0, std::ios::end);
+                std::streamoff size = file.tellg();
+                if(size >= 0){
+                    openSize = static_cast<size_t>(size);
+                    file.seekg(0, std::ios::beg);
+                }
+                file.clear();
+                textChunk.resize(BUFFER_SIZE);
+                window = textChunk.data();
                 readNextChunk();
+                if(bytesReadFromBuffer == BUFFER_SIZE){
+                    aheadChunk.resize(BUFFER_SIZE);
+                    reader = std::thread([this](){ readerLoop(); });
+                }
+            }
+            InputFileReader(const InputFileReader&) = delete;
+            InputFileReader& operator=(const InputFileReader&) = delete;
+
+            // Keeps a (name, bool) call from resolving to the in-memory
+            // constructor below.
+            InputFileReader(const char* fileName, bool allowMmap = true)
+                : InputFileReader(std::string(fileName), allowMmap){}
+
+            // Reads size bytes at data, which must outlive the reader.
+            InputFileReader(const char* data, size_t size) : inMemory(true){
+                window = data;
+                bytesReadFromBuffer = size;
             }
 
             bool isEof(){
                 return eof == 1;
             }
 
+            bool isMapped() const{
+                return mapped.isMapped();
+            }
+
+            // The whole file as one contiguous span. Empty unless isMapped().
+            std::string_view fileView() const{
+                return std::string_view(mapped.data(), mapped.size());
+            }
+
+            // The whole input as one span when it is mapped or in memory;
+            // empty when it is read in chunks.
+            std::string_view wholeInput() const{
+                if(mapped.isMapped() || inMemory){
+                    return std::string_view(window, bytesReadFromBuffer);
+                }
+                return std::string_view();
+            }
+
+            // Size of the input for sizing buffers: exact when it is mapped or
+            // in memory, the size at open for other regular files, 0 when
+            // unknown (pipes, devices).
+            size_t expectedSize() const{
+                if(mapped.isMapped() || inMemory){
+                    return bytesReadFromBuffer;
+                }
+                return openSize;
+            }
+
+            // Offset of the read position into wholeInput().
+            size_t position() const{
+                return bytesReadFromFile;
+            }
+
             char readNextChar(){
-                if(bytesReadFromFile >= bytesReadFromBuffer){
-                    readNextChunk();
-                    bytesReadFromFile = 0;   
+                if(bytesReadFromFile >= bytesReadFromBuffer && !refill()){
+                    return '\0';
                 }
-                return textChunk[bytesReadFromFile++];
+                return window[bytesReadFromFile++];
             }
+
+            // Unread bytes of the current window, refilling it first if it is
+            // exhausted. Empty only at end of input. The view stays valid until
+            // the next call that refills (readNextChar/currentChunk past its end).
+            std::string_view currentChunk(){
+                if(bytesReadFromFile >= bytesReadFromBuffer && !refill()){
+                    return std::string_view();
+                }
+                return std::string_view(window + bytesReadFromFile, bytesReadFromBuffer - bytesReadFromFile);
+            }
+
+            void advance(size_t count){
+                bytesReadFromFile += count;
+            }
+
             ~InputFileReader() {
+                if (reader.joinable()) {
+                    {
+                        std::lock_guard<std::mutex> guard(lock);
+                        stopping = true;
+                    }
+                    changed.notify_all();
+                    reader.join();
+                }
                 if (file.is_open()) {
                     file.close();
                 }
             }
     };
 
-};
+    // Consecutive newline-delimited records (JSON Lines) read from an
+    // InputFileReader, about maxBytes at a time. Records are split on '\n'
+    // alone, which is safe because JSON strings cannot hold a raw newline; a
+    // trailing '\r' is dropped. Blank lines are kept as records so that
+    // firstLine + i is always the line number of records()[i]. Records view
+    // the mapped file or, for streamed input, the batch's own storage, and are
+    // valid until the next fill(). A batch holds at most maxBytes plus one
+    // record, however large the input is.
+    class LineBatch{
+        private:
+            static const size_t MAX_RECORDS = 1 << 16;
+            std::string storage;
+            std::vector<std::pair<size_t, size_t>> spans;
+            std::vector<std::string_view> lines;
+            size_t firstLineNumber = 1;
+            size_t nextLineNumber = 1;
+
+            static std::string_view trimReturn(std::string_view line){
+                if(!line.empty() && line.back() == '\r'){
+                    line.remove_suffix(1);
+                }
+                return line;
+            }
+
+        public:
+            // Reads the next batch: lines until about maxBytes of input,
+            // newlines included, or MAX_RECORDS lines. False once the input
+            // is exhausted.
+            bool fill(InputFileReader& reader, size_t maxBytes){
+                lines.clear();
+                spans.clear();
+                storage.clear();
+                firstLineNumber = nextLineNumber;
 
+                size_t bytes = 0;
+                if(reader.isMapped()){
+                    while(bytes < maxBytes && lines.size() < MAX_RECORDS){
+                        std::string_view rest = reader.currentChunk();
+                        if(rest.empty()){
+                            break;
+                        }
+                        const char* newline = static_cast<const char*>(std::memchr(rest.data(), '\n', rest.size()));
+                        size_t len = newline ? static_cast<size_t>(newline - rest.data()) : rest.size();
+                        lines.push_back(trimReturn(rest.substr(0, len)));
+                        reader.advance(newline ? len + 1 : len);
+                        bytes += len + 1;
+                    }
+                }
+                else{
+                    size_t recordStart = 0;
+                    while(recordStart < storage.size() || (bytes < maxBytes && spans.size() < MAX_RECORDS)){
+                        std::string_view chunk = reader.currentChunk();
+                        if(chunk.empty()){
+                            if(recordStart < storage.size()){
+                                spans.emplace_back(recordStart, storage.size() - recordStart);
+                            }
+                            break;
+                        }
+                        const char* newline = static_cast<const char*>(std::memchr(chunk.data(), '\n', chunk.size()));
+                        if(newline == nullptr){
+                            storage.append(chunk.data(), chunk.size());
+                            reader.advance(chunk.size());
+                            bytes += chunk.size();
+                            continue;
+                        }
+                        size_t len = newline - chunk.data();
+                        storage.append(chunk.data(), len);
+                        spans.emplace_back(recordStart, storage.size() - recordStart);
+                        recordStart = storage.size();
+                        reader.advance(len + 1);
+                        bytes += len + 1;
+                    }
+                    for(auto& span : spans){
+                        lines.push_back(trimReturn(std::string_view(storage.data() + span.first, span.second)));
+                    }
+                }
+                nextLineNumber += lines.size();
+                return !lines.empty();
+            }
+
+            const std::vector<std::string_view>& records() const{
+                return lines;
+            }
+
+            // 1-based line number of records()[0].
+            size_t firstLine() const{
+                return firstLineNumber;
+            }
+
+            static bool isBlank(std::string_view line){
+                for(char ch : line){
+                    if(ch != ' ' && ch != '\t' && ch != '\r'){
+                        return false;
+                    }
+                }
+                return true;
+            }
+    };
+
+};
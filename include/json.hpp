@@ -1,15 +1,36 @@
 #pragma once
+#include "jsoncolumns.hpp"
+#include "jsondom.hpp"
+#include "jsonindex.hpp"
 #include "jsonparse.hpp"
+#include "jsonsax.hpp"
+#include "jsonstats.hpp"
 #include "jsontok.hpp"
+#include "jsonwrite.hpp"
+#include "workpool.hpp"
 
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 namespace json {
 
+// A handle on a value in either tree: the shared_ptr JPtr tree built by
+// JsonParser, or an arena-backed jsondom::Document (see loadArena and
+// openSnapshot). Handles into a Document share ownership of the whole
+// document.
 class Json {
 private:
     jsonparse::JPtr root;
+    std::shared_ptr<const jsondom::Document> doc;
+    const jsondom::Node* node = nullptr;
 
     static void require(bool cond, const char* msg) {
         if (!cond) throw std::runtime_error(msg);
@@ -33,91 +54,558 @@ private:
         return static_cast<jsonparse::JsonLiteral*>(root.get());
     }
 
+    Json(std::shared_ptr<const jsondom::Document> d, const jsondom::Node* n) : doc(std::move(d)), node(n) {}
+
+    const jsondom::Node& objectNode() const {
+        require(node->getObjType() == jsonparse::JsonObjectType::OBJECT, "Not a JsonObject");
+        return *node;
+    }
+
+    const jsondom::Node& arrayNode() const {
+        require(node->getObjType() == jsonparse::JsonObjectType::ARRAY, "Not a JsonArray");
+        return *node;
+    }
+
 public:
     explicit Json(jsonparse::JPtr p) : root(p) {}
 
-    explicit Json(const std::string& fileName) {
+    // memoryBudget (bytes, 0 = unlimited) caps what the tree may take;
+    // jsonparse::MemoryBudgetExceeded is thrown as soon as it would go over.
+    explicit Json(const std::string& fileName, size_t memoryBudget = 0) {
         jsontok::JsonOnDemandTokenizer tokenizer(fileName);
-        root = jsonparse::JsonParser::startParsing(tokenizer);
+        jsonparse::MemoryBudget budget(memoryBudget);
+        root = jsonparse::JsonParser::startParsing(tokenizer, memoryBudget ? &budget : nullptr);
         require(root != nullptr, "Parsing failed");
     }
 
+    // Parses a document held in memory. Unlike the file constructor, anything
+    // but whitespace after the top-level value is an error.
+    static Json parse(std::string_view text, size_t memoryBudget = 0) {
+        jsontok::JsonOnDemandTokenizer tokenizer(text.data(), text.size());
+        jsonparse::MemoryBudget budget(memoryBudget);
+        Json result(jsonparse::JsonParser::startParsing(tokenizer, memoryBudget ? &budget : nullptr));
+        require(result.root != nullptr, "Parsing failed");
+        require(tokenizer.getNextToken().getTokenType() == jsontok::TokenType::END_OF_FILE,
+                "Unexpected data after the JSON value");
+        return result;
+    }
+
+    // Parses into a single-allocation arena document instead of a tree of
+    // shared_ptr nodes; cheaper to build and to free for large inputs.
+    static Json loadArena(const std::string& fileName, size_t memoryBudget = 0) {
+        jsontok::JsonOnDemandTokenizer tokenizer(fileName);
+        jsonparse::MemoryBudget budget(memoryBudget);
+        std::shared_ptr<const jsondom::Document> document =
+            jsondom::DocumentParser::startParsing(tokenizer, memoryBudget ? &budget : nullptr);
+        const jsondom::Node* top = &document->root();
+        return Json(std::move(document), top);
+    }
+
+    // Maps a snapshot written by saveSnapshot as a read-only arena-backed
+    // handle. Nothing is parsed or copied, so opening costs the same for any
+    // document size.
+    static Json openSnapshot(const std::string& fileName) {
+        std::shared_ptr<const jsondom::Document> document = jsondom::Document::openSnapshot(fileName);
+        const jsondom::Node* top = &document->root();
+        return Json(std::move(document), top);
+    }
+
     bool isObject() const {
+        if (node) return node->getObjType() == jsonparse::JsonObjectType::OBJECT;
         return root && root->getObjType() == jsonparse::JsonObjectType::OBJECT;
     }
 
     bool isArray() const {
+        if (node) return node->getObjType() == jsonparse::JsonObjectType::ARRAY;
         return root && root->getObjType() == jsonparse::JsonObjectType::ARRAY;
     }
 
     bool isLiteral() const {
+        if (node) return node->getObjType() == jsonparse::JsonObjectType::LITERAL;
         return root && root->getObjType() == jsonparse::JsonObjectType::LITERAL;
     }
 
     bool isString() const {
+        if (node) return node->isLiteral(jsonparse::LiteralType::STRING);
         return isLiteral() &&
                asLiteralPtr()->getLiteralType() == jsonparse::LiteralType::STRING;
     }
 
     bool isNumber() const {
+        if (node) return node->isLiteral(jsonparse::LiteralType::NUMBER);
         return isLiteral() &&
                asLiteralPtr()->getLiteralType() == jsonparse::LiteralType::NUMBER;
     }
 
     bool isBool() const {
+        if (node) return node->isLiteral(jsonparse::LiteralType::BOOL);
         return isLiteral() &&
                asLiteralPtr()->getLiteralType() == jsonparse::LiteralType::BOOL;
     }
 
     bool isNull() const {
+        if (node) return node->isLiteral(jsonparse::LiteralType::NULL_VAL);
         return isLiteral() &&
                asLiteralPtr()->getLiteralType() == jsonparse::LiteralType::NULL_VAL;
     }
 
-    Json operator[](const std::string& key) const {
+    Json operator[](std::string_view key) const {
+        if (node) {
+            const jsondom::Node* value = doc->findMember(objectNode(), key);
+            if (value == nullptr) throw std::runtime_error("Key not found: " + std::string(key));
+            return Json(doc, value);
+        }
         return Json(asObjectPtr()->getValue(key));
     }
 
     Json operator[](size_t index) const {
+        if (node) {
+            require(index < arrayNode().length, "Index out of bounds");
+            return Json(doc, doc->children(*node) + index);
+        }
         auto arr = asArrayPtr();
         require(index < arr->getArrayVals().size(), "Index out of bounds");
         return Json(arr->getArrayVals()[index]);
     }
 
-    bool hasKey(const std::string& key) const {
-        auto obj = asObjectPtr();
-        for (const auto& kv : obj->getKeyPairs())
-            if (kv.first == key)
-                return true;
-        return false;
+    bool hasKey(std::string_view key) const {
+        if (node) return doc->findMember(objectNode(), key) != nullptr;
+        return asObjectPtr()->findValue(key) != nullptr;
     }
 
     size_t objectSize() const {
+        if (node) return objectNode().length;
         return asObjectPtr()->getKeyPairs().size();
     }
 
     size_t arraySize() const {
+        if (node) return arrayNode().length;
         return asArrayPtr()->getArrayVals().size();
     }
 
     std::string asString() const {
         require(isString(), "Not a string");
+        if (node) return std::string(doc->getString(*node));
         return static_cast<jsonparse::JsonString*>(asLiteralPtr())->getValue();
     }
 
     float asNumber() const {
+        return static_cast<float>(asDouble());
+    }
+
+    double asDouble() const {
+        return numberValue().asDouble();
+    }
+
+    // Exact for integer literals; throws if the value is not an integer in
+    // range.
+    int64_t asInt64() const {
+        return numberValue().asInt64();
+    }
+
+    uint64_t asUint64() const {
+        return numberValue().asUint64();
+    }
+
+    jsontok::NumberValue numberValue() const {
         require(isNumber(), "Not a number");
-        return static_cast<jsonparse::JsonNumber*>(asLiteralPtr())->getValue();
+        if (node) return doc->getNumber(*node);
+        return static_cast<jsonparse::JsonNumber*>(asLiteralPtr())->getNumberValue();
     }
 
     bool asBool() const {
         require(isBool(), "Not a boolean");
+        if (node) return doc->getBool(*node);
         return static_cast<jsonparse::JsonBool*>(asLiteralPtr())->getValue();
     }
 
+    // Serializes the value into a fileutils::OutputFileWriter, BufferWriter or
+    // anything with the same surface: compact when indent < 0, otherwise
+    // pretty-printed with that indent.
+    template <typename Out>
+    void write(Out& out, int indent = -1) const {
+        jsonwrite::Serializer<Out> serializer(out, indent);
+        if (node) serializer.write(*doc, *node);
+        else serializer.write(root);
+    }
+
+    std::string dump(int indent = -1) const {
+        std::string text;
+        fileutils::BufferWriter writer(text);
+        write(writer, indent);
+        return text;
+    }
+
+    void save(const std::string& fileName, int indent = -1) const {
+        fileutils::OutputFileWriter writer(fileName);
+        write(writer, indent);
+    }
+
+    // Writes the value and everything below it as a binary snapshot for
+    // openSnapshot, from either tree.
+    void saveSnapshot(const std::string& fileName) const {
+        if (node) jsondom::SnapshotWriter::save(*doc, *node, fileName);
+        else jsondom::SnapshotWriter::save(root, fileName);
+    }
+
+    // Bytes the value's tree occupies. An arena-backed handle reports its
+    // whole document, which it keeps alive.
+    size_t memoryUsage() const {
+        if (node) return doc->memoryUsage();
+        return jsonparse::treeMemoryUsage(root);
+    }
+
+    // The underlying JPtr node; empty for arena-backed handles.
     jsonparse::JPtr raw() const {
         return root;
     }
 };
 
+// Keeps parsed files around for repeated loads of the same path. An entry is
+// reused only while the file's device, inode, size and modification time are
+// unchanged, and with hashContent also its content hash, which catches
+// rewrites that keep all four but costs a read of the file per load. Files
+// are parsed as by Json::loadArena, so the shared documents are immutable
+// and raw() is empty on what load() returns. Once the documents held pass
+// memoryCap bytes the least recently used ones are dropped; handles still
+// out keep theirs alive. Safe to use from any number of threads.
+class ParseCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+
+private:
+    struct Entry {
+        fileutils::FileIdentity identity;
+        uint64_t contentHash;
+        Json value;
+        size_t bytes;
+        std::list<std::string>::iterator recent;
+    };
+
+    mutable std::mutex lock;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> recent; // most recently used first
+    size_t memoryCap;
+    bool hashContent;
+    Stats counters;
+
+    // FNV-1a over the whole file; 0 when hashing is off.
+    static uint64_t hashFile(const std::string& fileName) {
+        fileutils::InputFileReader reader(fileName);
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        while (true) {
+            std::string_view chunk = reader.currentChunk();
+            if (chunk.empty())
+                break;
+            for (char ch : chunk) {
+                hash ^= static_cast<unsigned char>(ch);
+                hash *= 0x100000001b3ULL;
+            }
+            reader.advance(chunk.size());
+        }
+        return hash;
+    }
+
+    void erase(std::unordered_map<std::string, Entry>::iterator entry) {
+        counters.bytes -= entry->second.bytes;
+        recent.erase(entry->second.recent);
+        entries.erase(entry);
+    }
+
+    void evictTo(size_t bytes) {
+        while (counters.bytes > bytes && !recent.empty()) {
+            erase(entries.find(recent.back()));
+            counters.evictions++;
+        }
+    }
+
+public:
+    explicit ParseCache(size_t capBytes = size_t(256) << 20, bool hashContents = false)
+        : memoryCap(capBytes), hashContent(hashContents) {}
+
+    ParseCache(const ParseCache&) = delete;
+    ParseCache& operator=(const ParseCache&) = delete;
+
+    // The cache behind loadCached().
+    static ParseCache& global() {
+        static ParseCache cache;
+        return cache;
+    }
+
+    Json load(const std::string& fileName) {
+        fileutils::FileIdentity before;
+        bool cacheable = fileutils::fileIdentity(fileName, before);
+        bool hashing;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            hashing = hashContent;
+        }
+        uint64_t contentHash = cacheable && hashing ? hashFile(fileName) : 0;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = entries.find(fileName);
+            if (found != entries.end() && found->second.identity == before &&
+                found->second.contentHash == contentHash) {
+                counters.hits++;
+                recent.splice(recent.begin(), recent, found->second.recent);
+                return found->second.value;
+            }
+            counters.misses++;
+        }
+
+        // Parsed outside the lock: other files keep being served meanwhile.
+        Json value = Json::loadArena(fileName);
+        fileutils::FileIdentity after;
+        if (!cacheable || !fileutils::fileIdentity(fileName, after) || after != before)
+            return value; // changed while being parsed
+        size_t bytes = value.memoryUsage();
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (bytes > memoryCap || hashing != hashContent)
+            return value;
+        auto found = entries.find(fileName);
+        if (found != entries.end())
+            erase(found);
+        recent.push_front(fileName);
+        entries.emplace(fileName, Entry{before, contentHash, value, bytes, recent.begin()});
+        counters.bytes += bytes;
+        evictTo(memoryCap);
+        return value;
+    }
+
+    // Drops every entry; counters are kept.
+    void clear() {
+        std::lock_guard<std::mutex> guard(lock);
+        entries.clear();
+        recent.clear();
+        counters.bytes = 0;
+    }
+
+    void setMemoryCap(size_t bytes) {
+        std::lock_guard<std::mutex> guard(lock);
+        memoryCap = bytes;
+        evictTo(memoryCap);
+    }
+
+    void setHashContent(bool enabled) {
+        std::lock_guard<std::mutex> guard(lock);
+        hashContent = enabled;
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> guard(lock);
+        Stats result = counters;
+        result.entries = entries.size();
+        return result;
+    }
+};
+
+// Json::loadArena through the process-wide ParseCache.
+inline Json loadCached(const std::string& fileName) {
+    return ParseCache::global().load(fileName);
+}
+
+// Parses every file on a work-stealing pool of `threads` workers (0 = one per
+// hardware thread). Results come back in the order of `files`; if any file
+// fails, the first error is rethrown once all of them have finished.
+// memoryBudget (bytes, 0 = unlimited) caps the trees of all files together.
+inline std::vector<Json> parseMany(const std::vector<std::string>& files, unsigned threads = 0,
+                                   size_t memoryBudget = 0) {
+    if (files.empty())
+        return {};
+    std::vector<jsonparse::JPtr> roots(files.size());
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads > files.size())
+        threads = static_cast<unsigned>(files.size());
+    jsonparse::MemoryBudget budget(memoryBudget);
+    jsonparse::MemoryBudget* shared = memoryBudget ? &budget : nullptr;
+    workpool::WorkStealingPool pool(threads);
+    for (size_t i = 0; i < files.size(); i++) {
+        pool.submit([&roots, &files, shared, i]() {
+            jsontok::JsonOnDemandTokenizer tokenizer(files[i]);
+            roots[i] = jsonparse::JsonParser::startParsing(tokenizer, shared);
+        });
+    }
+    pool.wait();
+
+    std::vector<Json> result;
+    result.reserve(files.size());
+    for (auto& root : roots)
+        result.emplace_back(std::move(root));
+    return result;
+}
+
+// Parses one large document on `threads` workers (0 = one per hardware
+// thread). A structural index of the mapped file gives the commas that
+// separate the root's members or elements; the root is cut at the commas
+// nearest to equal byte shares, each worker parses one share, and the shares
+// are joined in order. Input that cannot be mapped, a scalar root, or a
+// single thread parse on the calling thread as Json(fileName) does.
+// memoryBudget is as for Json(fileName, memoryBudget), shared by the workers.
+inline Json parseParallel(const std::string& fileName, unsigned threads = 0, size_t memoryBudget = 0) {
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    fileutils::InputFileReader reader(fileName);
+    std::string_view text = reader.wholeInput();
+    if (threads <= 1 || text.empty())
+        return Json(fileName, memoryBudget);
+    jsonindex::StructuralIndex index(text);
+    if (index.size() == 0 || !index.isOpener(0) || text.find_first_not_of(" \t\r\n") != index.offset(0))
+        return Json(fileName, memoryBudget);
+
+    const size_t opener = 0;
+    const size_t closer = index.matching(opener);
+    bool isObject = index.character(opener) == '{';
+    std::vector<size_t> cuts{opener};
+    size_t pieces = static_cast<size_t>(threads) * 4;
+    size_t span = index.offset(closer) - index.offset(opener);
+    for (size_t i = 1; i < pieces && cuts.back() != closer; i++) {
+        size_t entry = std::max(index.find(index.offset(opener) + span * i / pieces), cuts.back() + 1);
+        size_t cut = index.nextSeparator(entry, opener);
+        if (cut != closer)
+            cuts.push_back(cut);
+    }
+    cuts.push_back(closer);
+
+    struct Piece {
+        std::vector<std::string> keys;
+        std::vector<jsonparse::JPtr> values;
+    };
+    std::vector<Piece> parsed(cuts.size() - 1);
+    jsonparse::MemoryBudget budget(memoryBudget);
+    jsonparse::MemoryBudget* shared = memoryBudget ? &budget : nullptr;
+    workpool::WorkStealingPool pool(threads);
+    for (size_t i = 0; i < parsed.size(); i++) {
+        pool.submit([&, i]() {
+            size_t from = index.offset(cuts[i]) + 1;
+            jsontok::JsonOnDemandTokenizer tokenizer(text.data() + from, index.offset(cuts[i + 1]) - from);
+            jsonparse::JsonParser::parseRun(tokenizer, isObject ? &parsed[i].keys : nullptr, parsed[i].values,
+                                            parsed.size() == 1, shared);
+        });
+    }
+    pool.wait();
+
+    if (isObject) {
+        auto obj = std::make_shared<jsonparse::JsonObject>();
+        for (Piece& piece : parsed)
+            for (size_t v = 0; v < piece.values.size(); v++)
+                obj->addKeyPair(std::move(piece.keys[v]), std::move(piece.values[v]));
+        if (shared)
+            shared->charge(sizeof(jsonparse::JsonObject) + jsonparse::SHARED_NODE_OVERHEAD + obj->heapBytes());
+        return Json(std::move(obj));
+    }
+    auto arr = std::make_shared<jsonparse::JsonArray>();
+    for (Piece& piece : parsed)
+        for (jsonparse::JPtr& value : piece.values)
+            arr->addArrayVal(std::move(value));
+    if (shared)
+        shared->charge(sizeof(jsonparse::JsonArray) + jsonparse::SHARED_NODE_OVERHEAD + arr->heapBytes());
+    return Json(std::move(arr));
+}
+
+// Runs perRecord(records[i], results[i]) for every record of each JSON Lines
+// batch on a work-stealing pool, then afterBatch(batch, results) on the
+// calling thread before the next batch is read. results is reset to one
+// default Result per record at the start of every batch. perRecord must not
+// throw.
+template <typename Result, typename PerRecord, typename AfterBatch>
+void runLineBatches(const std::string& fileName, unsigned threads, size_t batchBytes,
+                    PerRecord perRecord, AfterBatch afterBatch) {
+    workpool::WorkStealingPool pool(threads);
+    size_t sliceCount = pool.size() * 4;
+    fileutils::InputFileReader reader(fileName);
+    fileutils::LineBatch batch;
+    std::vector<Result> results;
+    while (batch.fill(reader, batchBytes)) {
+        const std::vector<std::string_view>& records = batch.records();
+        results.clear();
+        results.resize(records.size());
+        size_t slices = std::min(sliceCount, records.size());
+        for (size_t i = 0; i < slices; i++) {
+            size_t from = records.size() * i / slices;
+            size_t to = records.size() * (i + 1) / slices;
+            pool.submit([&records, &results, &perRecord, from, to]() {
+                for (size_t r = from; r < to; r++)
+                    perRecord(records[r], results[r]);
+            });
+        }
+        pool.wait();
+        afterBatch(batch, results);
+    }
+}
+
+// Parses every non-blank line of a JSON Lines file and calls
+// onRecord(lineNumber, Json) for each, in input order. Lines are parsed in
+// parallel, about batchBytes of input at a time, so only one batch of
+// documents is held at once. A line that does not parse throws, naming the
+// line; records before it have already been delivered.
+template <typename Callback>
+void forEachLine(const std::string& fileName, Callback onRecord,
+                 unsigned threads = 0, size_t batchBytes = 1 << 20) {
+    struct Parsed {
+        jsonparse::JPtr root;
+        std::string error;
+    };
+    runLineBatches<Parsed>(fileName, threads, batchBytes,
+        [](std::string_view record, Parsed& parsed) {
+            if (fileutils::LineBatch::isBlank(record))
+                return;
+            try {
+                parsed.root = Json::parse(record).raw();
+            }
+            catch (const std::exception& e) {
+                parsed.error = e.what();
+            }
+        },
+        [&](const fileutils::LineBatch& batch, std::vector<Parsed>& results) {
+            for (size_t r = 0; r < results.size(); r++) {
+                if (!results[r].error.empty())
+                    throw std::runtime_error("Line " + std::to_string(batch.firstLine() + r) + ": " + results[r].error);
+                if (results[r].root)
+                    onRecord(batch.firstLine() + r, Json(std::move(results[r].root)));
+            }
+        });
+}
+
+// Checks every non-blank line of a JSON Lines file without building any tree.
+// Returns how many lines are invalid; onInvalid(lineNumber, message) is called
+// for each of them in input order when given.
+inline size_t validateLines(const std::string& fileName,
+                            const std::function<void(size_t, const std::string&)>& onInvalid = nullptr,
+                            unsigned threads = 0, size_t batchBytes = 4 << 20) {
+    size_t invalid = 0;
+    runLineBatches<std::string>(fileName, threads, batchBytes,
+        [](std::string_view record, std::string& error) {
+            if (fileutils::LineBatch::isBlank(record))
+                return;
+            try {
+                jsontok::JsonOnDemandTokenizer tokenizer(record.data(), record.size());
+                jsonsax::Visitor visitor;
+                jsonsax::parse(tokenizer, visitor);
+                if (tokenizer.getNextToken().getTokenType() != jsontok::TokenType::END_OF_FILE)
+                    throw std::runtime_error("Unexpected data after the JSON value");
+            }
+            catch (const std::exception& e) {
+                error = e.what();
+            }
+        },
+        [&](const fileutils::LineBatch& batch, std::vector<std::string>& errors) {
+            for (size_t r = 0; r < errors.size(); r++) {
+                if (errors[r].empty())
+                    continue;
+                invalid++;
+                if (onInvalid)
+                    onInvalid(batch.firstLine() + r, errors[r]);
+            }
+        });
+    return invalid;
+}
+
 }
@@ -0,0 +1,554 @@
+#pragma once
+#include "fileutils.hpp"
+#include "jsonfmt.hpp"
+#include "jsonstats.hpp"
+#include "jsontok.hpp"
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace jsoncolumns {
+
+    enum class ColumnType : uint8_t {
+        INT64,
+        DOUBLE,
+        BOOL,
+        STRING
+    };
+
+    inline const char* typeName(ColumnType type) {
+        switch (type) {
+            case ColumnType::INT64: return "int64";
+            case ColumnType::DOUBLE: return "double";
+            case ColumnType::BOOL: return "bool";
+            default: return "string";
+        }
+    }
+
+    // A JSON Pointer into each record and the type its values must have.
+    struct ColumnSpec {
+        std::string path;
+        ColumnType type;
+    };
+
+    // One typed column: a contiguous value vector of the column's type plus
+    // a validity bitmap (bit r of word r / 64 set when row r is not null).
+    // Null rows hold 0, 0.0, false or code 0. Strings are dictionary encoded:
+    // codes index dictionary entries, which are decoded text in first-seen
+    // order.
+    class Column {
+    private:
+        std::string columnPath;
+        ColumnType columnType;
+        size_t rows = 0;
+        std::vector<uint64_t> valid;
+        std::vector<int64_t> int64Values;
+        std::vector<double> doubleValues;
+        std::vector<uint8_t> boolValues;
+        std::vector<uint32_t> codeValues;
+        // A deque keeps entries in place, so the index can key on views of them.
+        std::deque<std::string> dictionaryEntries;
+        std::unordered_map<std::string_view, uint32_t> dictionaryIndex;
+
+        void addRow(bool isValid) {
+            if (rows % 64 == 0)
+                valid.push_back(0);
+            if (isValid)
+                valid.back() |= uint64_t(1) << (rows % 64);
+            rows++;
+        }
+
+        friend class ColumnSet;
+
+    public:
+        Column(std::string path, ColumnType type) : columnPath(std::move(path)), columnType(type) {}
+        // Move-only: the dictionary index points into this column's entries.
+        Column(const Column&) = delete;
+        Column& operator=(const Column&) = delete;
+        Column(Column&&) = default;
+        Column& operator=(Column&&) = default;
+
+        const std::string& path() const { return columnPath; }
+        ColumnType type() const { return columnType; }
+        size_t size() const { return rows; }
+
+        bool isNull(size_t row) const {
+            return (valid[row / 64] >> (row % 64) & 1) == 0;
+        }
+
+        const std::vector<uint64_t>& validity() const { return valid; }
+        const std::vector<int64_t>& int64s() const { return int64Values; }
+        const std::vector<double>& doubles() const { return doubleValues; }
+        const std::vector<uint8_t>& bools() const { return boolValues; }
+        const std::vector<uint32_t>& codes() const { return codeValues; }
+        const std::deque<std::string>& dictionary() const { return dictionaryEntries; }
+
+        void appendNull() {
+            switch (columnType) {
+                case ColumnType::INT64: int64Values.push_back(0); break;
+                case ColumnType::DOUBLE: doubleValues.push_back(0); break;
+                case ColumnType::BOOL: boolValues.push_back(0); break;
+                default: codeValues.push_back(0);
+            }
+            addRow(false);
+        }
+
+        void appendInt64(int64_t value) {
+            int64Values.push_back(value);
+            addRow(true);
+        }
+
+        void appendDouble(double value) {
+            doubleValues.push_back(value);
+            addRow(true);
+        }
+
+        void appendBool(bool value) {
+            boolValues.push_back(value ? 1 : 0);
+            addRow(true);
+        }
+
+        void appendString(std::string_view value) {
+            auto found = dictionaryIndex.find(value);
+            uint32_t code;
+            if (found != dictionaryIndex.end()) {
+                code = found->second;
+            }
+            else {
+                code = static_cast<uint32_t>(dictionaryEntries.size());
+                dictionaryEntries.emplace_back(value);
+                dictionaryIndex.emplace(dictionaryEntries.back(), code);
+            }
+            codeValues.push_back(code);
+            addRow(true);
+        }
+    };
+
+    // Columns of equal length, one row per record.
+    //
+    // File layout (native byte order, every array 8-byte aligned from the
+    // start of the file by zero padding):
+    //   "JCOL", uint32 version, uint64 rows, uint32 columns
+    //   per column: uint32 path length, path, uint8 type,
+    //               uint64 validity[(rows + 63) / 64],
+    //               int64 / double / uint8 values[rows], or for strings
+    //               uint32 entries, (uint32 length, bytes) per entry,
+    //               uint32 codes[rows]
+    class ColumnSet {
+    private:
+        static constexpr uint32_t VERSION = 1;
+        std::vector<Column> columnList;
+        size_t rows = 0;
+
+        template <typename T>
+        static void put(fileutils::OutputFileWriter& out, size_t& at, const T& value) {
+            out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+            at += sizeof(T);
+        }
+
+        template <typename T>
+        static void putArray(fileutils::OutputFileWriter& out, size_t& at, const std::vector<T>& values) {
+            static const char zeros[8] = {};
+            out.write(zeros, (8 - at % 8) % 8);
+            at += (8 - at % 8) % 8;
+            if (!values.empty())
+                out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+            at += values.size() * sizeof(T);
+        }
+
+        struct Cursor {
+            std::string_view data;
+            size_t at = 0;
+
+            const char* take(size_t count) {
+                if (data.size() - at < count)
+                    throw std::runtime_error("Column file is truncated");
+                const char* p = data.data() + at;
+                at += count;
+                return p;
+            }
+
+            template <typename T>
+            T get() {
+                T value;
+                std::memcpy(&value, take(sizeof(T)), sizeof(T));
+                return value;
+            }
+
+            template <typename T>
+            void getArray(std::vector<T>& values, size_t count) {
+                take((8 - at % 8) % 8);
+                values.resize(count);
+                const char* p = take(count * sizeof(T));
+                if (count > 0)
+                    std::memcpy(values.data(), p, count * sizeof(T));
+            }
+        };
+
+    public:
+        ColumnSet() = default;
+
+        explicit ColumnSet(const std::vector<ColumnSpec>& specs) {
+            for (const ColumnSpec& spec : specs)
+                columnList.emplace_back(spec.path, spec.type);
+        }
+
+        size_t rowCount() const { return rows; }
+        size_t columnCount() const { return columnList.size(); }
+        const Column& column(size_t i) const { return columnList[i]; }
+        Column& column(size_t i) { return columnList[i]; }
+        const std::vector<Column>& columns() const { return columnList; }
+
+        // Ends a row: columns given no value in it get a null.
+        void endRow() {
+            rows++;
+            for (Column& c : columnList)
+                if (c.size() < rows)
+                    c.appendNull();
+        }
+
+        void write(const std::string& fileName) const {
+            fileutils::OutputFileWriter out(fileName);
+            size_t at = 0;
+            out.write("JCOL", 4);
+            at += 4;
+            put(out, at, VERSION);
+            put(out, at, static_cast<uint64_t>(rows));
+            put(out, at, static_cast<uint32_t>(columnList.size()));
+            for (const Column& c : columnList) {
+                put(out, at, static_cast<uint32_t>(c.path().size()));
+                out.write(c.path().data(), c.path().size());
+                at += c.path().size();
+                put(out, at, static_cast<uint8_t>(c.type()));
+                putArray(out, at, c.validity());
+                switch (c.type()) {
+                    case ColumnType::INT64: putArray(out, at, c.int64s()); break;
+                    case ColumnType::DOUBLE: putArray(out, at, c.doubles()); break;
+                    case ColumnType::BOOL: putArray(out, at, c.bools()); break;
+                    default:
+                        put(out, at, static_cast<uint32_t>(c.dictionary().size()));
+                        for (const std::string& entry : c.dictionary()) {
+                            put(out, at, static_cast<uint32_t>(entry.size()));
+                            out.write(entry.data(), entry.size());
+                            at += entry.size();
+                        }
+                        putArray(out, at, c.codes());
+                }
+            }
+        }
+
+        static ColumnSet read(const std::string& fileName) {
+            fileutils::InputFileReader reader(fileName);
+            std::string text;
+            while (true) {
+                std::string_view chunk = reader.currentChunk();
+                if (chunk.empty())
+                    break;
+                text.append(chunk.data(), chunk.size());
+                reader.advance(chunk.size());
+            }
+            Cursor in{text};
+            if (std::string_view(in.take(4), 4) != "JCOL" || in.get<uint32_t>() != VERSION)
+                throw std::runtime_error("Not a column file: " + fileName);
+            ColumnSet set;
+            set.rows = in.get<uint64_t>();
+            uint32_t count = in.get<uint32_t>();
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t pathLength = in.get<uint32_t>();
+                std::string path(in.take(pathLength), pathLength);
+                uint8_t type = in.get<uint8_t>();
+                if (type > static_cast<uint8_t>(ColumnType::STRING))
+                    throw std::runtime_error("Unknown column type in " + fileName);
+                Column c(std::move(path), static_cast<ColumnType>(type));
+                in.getArray(c.valid, (set.rows + 63) / 64);
+                c.rows = set.rows;
+                switch (c.type()) {
+                    case ColumnType::INT64: in.getArray(c.int64Values, set.rows); break;
+                    case ColumnType::DOUBLE: in.getArray(c.doubleValues, set.rows); break;
+                    case ColumnType::BOOL: in.getArray(c.boolValues, set.rows); break;
+                    default: {
+                        uint32_t entries = in.get<uint32_t>();
+                        for (uint32_t e = 0; e < entries; e++) {
+                            uint32_t length = in.get<uint32_t>();
+                            c.dictionaryEntries.emplace_back(in.take(length), length);
+                            c.dictionaryIndex.emplace(c.dictionaryEntries.back(), e);
+                        }
+                        in.getArray(c.codeValues, set.rows);
+                    }
+                }
+                set.columnList.push_back(std::move(c));
+            }
+            return set;
+        }
+    };
+
+    // Fills a ColumnSet one record at a time straight from the tokenizer.
+    // Only the members and elements on a column's path are looked at; every
+    // other value is skipped by bracket counting. A path missing from a
+    // record, or holding null, gives a null; a value of the wrong type
+    // throws. When a path matches more than once (a duplicate key or a "*"
+    // token), the first value counts.
+    class ColumnExtractor {
+    private:
+        static constexpr uint32_t NONE = jsonfmt::PointerSet::NONE;
+        jsonfmt::PointerSet paths; // path ids are column numbers
+        ColumnSet result;
+
+        static std::vector<std::string> pathsOf(const std::vector<ColumnSpec>& specs) {
+            std::vector<std::string> pointers;
+            for (const ColumnSpec& spec : specs)
+                pointers.push_back(spec.path);
+            return pointers;
+        }
+
+        [[noreturn]] void typeError(const Column& c, const char* found) {
+            throw std::runtime_error(c.path() + ": expected " + typeName(c.type()) + ", found " + found);
+        }
+
+        // False once every column ending at node has its value for this row.
+        bool needsValue(uint32_t node) const {
+            for (uint32_t column : paths.pointers(node))
+                if (result.column(column).size() <= result.rowCount())
+                    return true;
+            return false;
+        }
+
+        void store(Column& c, const jsontok::Token& tok) {
+            if (c.size() > result.rowCount())
+                return;
+            switch (tok.getTokenType()) {
+                case jsontok::TokenType::NULL_VAL:
+                    c.appendNull();
+                    return;
+                case jsontok::TokenType::NUMBER:
+                    if (c.type() == ColumnType::INT64) {
+                        int64_t value = 0;
+                        try {
+                            value = tok.getNumberValue().asInt64();
+                        }
+                        catch (const std::exception&) {
+                            typeError(c, "a number that is not an int64");
+                        }
+                        c.appendInt64(value);
+                    }
+                    else if (c.type() == ColumnType::DOUBLE)
+                        c.appendDouble(tok.getNumberValue().asDouble());
+                    else
+                        typeError(c, "a number");
+                    return;
+                case jsontok::TokenType::BOOL:
+                    if (c.type() != ColumnType::BOOL)
+                        typeError(c, "a bool");
+                    c.appendBool(tok.getRawTokenValue() == "true");
+                    return;
+                case jsontok::TokenType::STRING: {
+                    if (c.type() != ColumnType::STRING)
+                        typeError(c, "a string");
+                    std::string_view raw = tok.getRawTokenValue();
+                    if (raw.find('\\') == std::string_view::npos)
+                        c.appendString(raw);
+                    else
+                        c.appendString(jsontok::unescapeString(raw));
+                    return;
+                }
+                default:
+                    typeError(c, tok.getTokenType() == jsontok::TokenType::OPEN_BRACE ? "an object" : "an array");
+            }
+        }
+
+        static void expect(const jsontok::Token& tok, jsontok::TokenType type, const char* what) {
+            if (tok.getTokenType() != type)
+                throw std::runtime_error(std::string("Expected ") + what + ", found '" +
+                                         std::string(tok.getRawTokenValue()) + "'");
+        }
+
+        void readValue(jsontok::JsonOnDemandTokenizer& tokenizer, uint32_t node) {
+            if (node == NONE) {
+                tokenizer.skipValue();
+                return;
+            }
+            if (paths.selected(node)) {
+                if (!needsValue(node)) {
+                    tokenizer.skipValue();
+                    return;
+                }
+                jsontok::Token tok = tokenizer.getNextToken();
+                for (uint32_t column : paths.pointers(node))
+                    store(result.column(column), tok);
+                return;
+            }
+            jsontok::Token tok = tokenizer.getNextToken();
+            switch (tok.getTokenType()) {
+                case jsontok::TokenType::OPEN_BRACE:
+                    readObject(tokenizer, node);
+                    return;
+                case jsontok::TokenType::OPEN_BRACK:
+                    readArray(tokenizer, node);
+                    return;
+                case jsontok::TokenType::STRING:
+                case jsontok::TokenType::NUMBER:
+                case jsontok::TokenType::BOOL:
+                case jsontok::TokenType::NULL_VAL:
+                    return;
+                default:
+                    expect(tok, jsontok::TokenType::NULL_VAL, "a value");
+            }
+        }
+
+        void readObject(jsontok::JsonOnDemandTokenizer& tokenizer, uint32_t node) {
+            jsontok::Token tok = tokenizer.getNextToken();
+            if (tok.getTokenType() == jsontok::TokenType::CLOSE_BRACE)
+                return;
+            while (true) {
+                expect(tok, jsontok::TokenType::STRING, "an object key");
+                std::string_view key = tok.getRawTokenValue();
+                uint32_t child = key.find('\\') == std::string_view::npos
+                    ? paths.memberChild(node, key)
+                    : paths.memberChild(node, jsontok::unescapeString(key));
+                expect(tokenizer.getNextToken(), jsontok::TokenType::COLON, "':'");
+                readValue(tokenizer, child);
+                tok = tokenizer.getNextToken();
+                if (tok.getTokenType() == jsontok::TokenType::CLOSE_BRACE)
+                    return;
+                expect(tok, jsontok::TokenType::COMMA, "',' or '}'");
+                tok = tokenizer.getNextToken();
+            }
+        }
+
+        void readArray(jsontok::JsonOnDemandTokenizer& tokenizer, uint32_t node) {
+            if (tokenizer.peekNextToken().getTokenType() == jsontok::TokenType::CLOSE_BRACK) {
+                tokenizer.getNextToken();
+                return;
+            }
+            for (size_t index = 0; ; index++) {
+                readValue(tokenizer, paths.elementChild(node, index));
+                jsontok::Token tok = tokenizer.getNextToken();
+                if (tok.getTokenType() == jsontok::TokenType::CLOSE_BRACK)
+                    return;
+                expect(tok, jsontok::TokenType::COMMA, "',' or ']'");
+            }
+        }
+
+    public:
+        // Paths may share a node through "*" (/*/x and /a/x both take
+        // a.x), but a value read for a column cannot also lead to another.
+        explicit ColumnExtractor(const std::vector<ColumnSpec>& specs) : paths(pathsOf(specs)), result(specs) {
+            std::set<std::vector<std::string>> seen;
+            for (const ColumnSpec& spec : specs)
+                if (!seen.insert(jsonfmt::PointerSet::parsePointer(spec.path)).second)
+                    throw std::runtime_error("Duplicate column path: " + spec.path);
+            for (uint32_t node = 0; node < paths.size(); node++) {
+                if (paths.selected(node) && paths.hasChildren(node))
+                    throw std::runtime_error("Column path " + specs[paths.pointers(node)[0]].path +
+                                             " contains another column's path");
+            }
+        }
+
+        // Reads the next value from the tokenizer as one record (one row).
+        void addRecord(jsontok::JsonOnDemandTokenizer& tokenizer) {
+            JSONSTATS_PHASE(BUILD);
+            readValue(tokenizer, paths.root());
+            result.endRow();
+        }
+
+        const ColumnSet& columns() const { return result; }
+
+        ColumnSet take() { return std::move(result); }
+    };
+
+    // Moves the read position to the member or element named by one JSON
+    // Pointer token of the container that starts there; false if there is
+    // none.
+    inline bool enter(jsontok::JsonOnDemandTokenizer& tokenizer, const std::string& token) {
+        jsontok::Token tok = tokenizer.getNextToken();
+        if (tok.getTokenType() == jsontok::TokenType::OPEN_BRACE) {
+            tok = tokenizer.getNextToken();
+            while (tok.getTokenType() == jsontok::TokenType::STRING) {
+                std::string_view key = tok.getRawTokenValue();
+                bool match = key.find('\\') == std::string_view::npos ? key == token
+                                                                       : jsontok::unescapeString(key) == token;
+                if (tokenizer.getNextToken().getTokenType() != jsontok::TokenType::COLON)
+                    return false;
+                if (match)
+                    return true;
+                tokenizer.skipValue();
+                if (tokenizer.getNextToken().getTokenType() != jsontok::TokenType::COMMA)
+                    return false;
+                tok = tokenizer.getNextToken();
+            }
+            return false;
+        }
+        if (tok.getTokenType() != jsontok::TokenType::OPEN_BRACK || token.empty() ||
+            token.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        size_t index = std::stoull(token);
+        if (tokenizer.peekNextToken().getTokenType() == jsontok::TokenType::CLOSE_BRACK)
+            return false;
+        for (size_t i = 0; i < index; i++) {
+            tokenizer.skipValue();
+            if (tokenizer.getNextToken().getTokenType() != jsontok::TokenType::COMMA)
+                return false;
+        }
+        return true;
+    }
+
+    // Columns from an array of records, the root of the file or the array
+    // at recordsPointer.
+    inline ColumnSet extractRecords(const std::string& fileName, const std::vector<ColumnSpec>& specs,
+                                    const std::string& recordsPointer = "") {
+        ColumnExtractor extractor(specs);
+        jsontok::JsonOnDemandTokenizer tokenizer(fileName);
+        for (const std::string& token : jsonfmt::PointerSet::parsePointer(recordsPointer)) {
+            if (!enter(tokenizer, token))
+                throw std::runtime_error("Records not found at " + recordsPointer);
+        }
+        if (tokenizer.getNextToken().getTokenType() != jsontok::TokenType::OPEN_BRACK)
+            throw std::runtime_error("Expected an array of records at '" + recordsPointer + "'");
+        if (tokenizer.peekNextToken().getTokenType() == jsontok::TokenType::CLOSE_BRACK)
+            return extractor.take();
+        for (size_t record = 0; ; record++) {
+            try {
+                extractor.addRecord(tokenizer);
+            }
+            catch (const std::exception& e) {
+                throw std::runtime_error("Record " + std::to_string(record) + ": " + e.what());
+            }
+            jsontok::Token tok = tokenizer.getNextToken();
+            if (tok.getTokenType() == jsontok::TokenType::CLOSE_BRACK)
+                return extractor.take();
+            if (tok.getTokenType() != jsontok::TokenType::COMMA)
+                throw std::runtime_error("Expected ',' or ']' after record " + std::to_string(record));
+        }
+    }
+
+    // Columns from a JSON Lines file, one row per non-blank line.
+    inline ColumnSet extractLines(const std::string& fileName, const std::vector<ColumnSpec>& specs,
+                                  size_t batchBytes = 4 << 20) {
+        ColumnExtractor extractor(specs);
+        fileutils::InputFileReader reader(fileName);
+        fileutils::LineBatch batch;
+        while (batch.fill(reader, batchBytes)) {
+            const std::vector<std::string_view>& records = batch.records();
+            for (size_t r = 0; r < records.size(); r++) {
+                if (fileutils::LineBatch::isBlank(records[r]))
+                    continue;
+                try {
+                    jsontok::JsonOnDemandTokenizer tokenizer(records[r].data(), records[r].size());
+                    extractor.addRecord(tokenizer);
+                    if (tokenizer.getNextToken().getTokenType() != jsontok::TokenType::END_OF_FILE)
+                        throw std::runtime_error("Unexpected data after the JSON value");
+                }
+                catch (const std::exception& e) {
+                    throw std::runtime_error("Line " + std::to_string(batch.firstLine() + r) + ": " + e.what());
+                }
+            }
+        }
+        return extractor.take();
+    }
+}
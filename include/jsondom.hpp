@@ -0,0 +1,597 @@
+#pragma once
+#include "jsonparse.hpp"
+#include "jsonstats.hpp"
+#include "jsontok.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace jsondom {
+
+    // Bump allocator over one contiguous, growable buffer. Everything in it is
+    // addressed by offset, so growing never invalidates what was already
+    // stored, and the whole document goes away with a single free().
+    class Arena {
+    private:
+        char* base = nullptr;
+        size_t used = 0;
+        size_t capacity = 0;
+        jsonparse::MemoryBudget* budget = nullptr;
+
+        void grow(size_t needed) {
+            size_t newCapacity = capacity == 0 ? 1 << 16 : capacity;
+            while (newCapacity < needed)
+                newCapacity *= 2;
+            if (budget)
+                budget->charge(newCapacity - capacity); // before the allocation is made
+            JSONSTATS_ADD(allocations, 1);
+            char* grown = static_cast<char*>(std::realloc(base, newCapacity));
+            if (grown == nullptr)
+                throw std::bad_alloc();
+            base = grown;
+            capacity = newCapacity;
+        }
+
+    public:
+        Arena() {}
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        ~Arena() {
+            std::free(base);
+        }
+
+        // Returns the offset of `bytes` fresh bytes aligned to 8.
+        size_t allocate(size_t bytes) {
+            size_t offset = (used + 7) & ~size_t(7);
+            if (offset + bytes > capacity)
+                grow(offset + bytes);
+            used = offset + bytes;
+            return offset;
+        }
+
+        size_t store(std::string_view text) {
+            size_t offset = allocate(text.size());
+            if (!text.empty())
+                std::memcpy(base + offset, text.data(), text.size());
+            return offset;
+        }
+
+        char* at(size_t offset) {
+            return base + offset;
+        }
+
+        const char* at(size_t offset) const {
+            return base + offset;
+        }
+
+        size_t size() const {
+            return used;
+        }
+
+        size_t allocated() const {
+            return capacity;
+        }
+
+        // Growth is charged to budget (nullptr to stop) from now on.
+        void setBudget(jsonparse::MemoryBudget* target) {
+            budget = target;
+        }
+    };
+
+    // One JSON value. Containers and strings refer to their contents by
+    // arena offset:
+    //   OBJECT   length members at payload, each a key STRING node followed
+    //            by its value node; objects with at least
+    //            JsonObject::INDEX_THRESHOLD members are followed directly by
+    //            a keyTableSize(length) table of uint32 member index + 1
+    //   ARRAY    length element nodes at payload
+    //   STRING   length raw bytes (escapes still encoded) at payload
+    //   NUMBER   payload holds the bits of an int64, uint64 or double, as
+    //            told by numberKind
+    //   BOOL     payload is 0 or 1
+    struct Node {
+        uint8_t objType;
+        uint8_t literalType;
+        uint8_t numberKind;
+        uint8_t reserved[5];
+        uint64_t length;
+        uint64_t payload;
+
+        jsonparse::JsonObjectType getObjType() const {
+            return static_cast<jsonparse::JsonObjectType>(objType);
+        }
+
+        jsonparse::LiteralType getLiteralType() const {
+            return static_cast<jsonparse::LiteralType>(literalType);
+        }
+
+        bool isLiteral(jsonparse::LiteralType type) const {
+            return getObjType() == jsonparse::JsonObjectType::LITERAL && getLiteralType() == type;
+        }
+    };
+
+    static_assert(sizeof(Node) == 24, "jsondom::Node layout");
+
+    // Fills the key table that follows the members of a large OBJECT node.
+    inline void buildKeyTable(Arena& arena, const Node& object) {
+        const Node* member = reinterpret_cast<const Node*>(arena.at(object.payload));
+        uint32_t* table = reinterpret_cast<uint32_t*>(arena.at(object.payload + object.length * 2 * sizeof(Node)));
+        size_t mask = jsonparse::keyTableSize(object.length) - 1;
+        std::memset(table, 0, (mask + 1) * sizeof(uint32_t));
+        auto keyOf = [&](uint64_t i) {
+            return std::string_view(arena.at(member[i * 2].payload), member[i * 2].length);
+        };
+        for (uint64_t i = 0; i < object.length; i++) {
+            std::string_view key = keyOf(i);
+            for (size_t slot = jsonparse::hashKey(key) & mask;; slot = (slot + 1) & mask) {
+                if (table[slot] == 0) {
+                    table[slot] = static_cast<uint32_t>(i + 1);
+                    break;
+                }
+                if (keyOf(table[slot] - 1) == key)
+                    break;
+            }
+        }
+    }
+
+    // Header of a snapshot file, followed directly by the document's bytes
+    // exactly as they sit in its arena. Every reference in those bytes is an
+    // offset from their start, so a snapshot is used where it is mapped.
+    struct SnapshotHeader {
+        static constexpr uint32_t VERSION = 1;
+        static constexpr uint32_t ENDIAN_MARK = 0x01020304;
+
+        char magic[4];
+        uint32_t version;
+        uint32_t endianMark; // ENDIAN_MARK as written by the saving machine
+        uint32_t nodeSize;
+        uint64_t rootOffset;
+        uint64_t dataSize;
+    };
+
+    static_assert(sizeof(SnapshotHeader) % 8 == 0, "snapshot data must stay 8-byte aligned");
+
+    class Document {
+    private:
+        Arena arena;
+        size_t rootOffset = 0;
+        // A mapped snapshot is read in place; the arena stays empty then.
+        std::unique_ptr<fileutils::MappedFile> mapping;
+        const char* view = nullptr;
+
+        friend class DocumentParser;
+
+        const char* at(uint64_t offset) const {
+            return view ? view + offset : arena.at(offset);
+        }
+
+        static SnapshotHeader readHeader(std::string_view bytes, const std::string& fileName) {
+            SnapshotHeader header;
+            if (bytes.size() < sizeof(header))
+                throw std::runtime_error("Not a JSON snapshot: " + fileName);
+            std::memcpy(&header, bytes.data(), sizeof(header));
+            if (std::memcmp(header.magic, "JDOM", 4) != 0)
+                throw std::runtime_error("Not a JSON snapshot: " + fileName);
+            if (header.version != SnapshotHeader::VERSION)
+                throw std::runtime_error("Unsupported snapshot version " + std::to_string(header.version) +
+                                         " in " + fileName);
+            if (header.endianMark != SnapshotHeader::ENDIAN_MARK || header.nodeSize != sizeof(Node))
+                throw std::runtime_error("Snapshot " + fileName + " was written by an incompatible build");
+            if (header.dataSize != bytes.size() - sizeof(header))
+                throw std::runtime_error("Snapshot " + fileName + " is truncated");
+            if (header.rootOffset % 8 != 0 || header.dataSize < sizeof(Node) ||
+                header.rootOffset > header.dataSize - sizeof(Node))
+                throw std::runtime_error("Snapshot " + fileName + " has no valid root");
+            return header;
+        }
+
+    public:
+        // Opens a snapshot written by SnapshotWriter. The file is mapped
+        // read-only and used as it is: only the header is read and checked,
+        // so opening takes the same time at any document size and pages are
+        // faulted in as values are reached. Offsets past the header are
+        // trusted, so only open snapshots this library wrote. Where mapping
+        // is unavailable the data is read into the arena instead.
+        static std::shared_ptr<const Document> openSnapshot(const std::string& fileName) {
+            auto doc = std::make_shared<Document>();
+            doc->mapping = std::make_unique<fileutils::MappedFile>();
+            if (doc->mapping->open(fileName)) {
+                std::string_view bytes(doc->mapping->data(), doc->mapping->size());
+                doc->rootOffset = readHeader(bytes, fileName).rootOffset;
+                doc->view = bytes.data() + sizeof(SnapshotHeader);
+                return doc;
+            }
+            doc->mapping.reset();
+            fileutils::InputFileReader reader(fileName);
+            std::string bytes;
+            while (true) {
+                std::string_view chunk = reader.currentChunk();
+                if (chunk.empty())
+                    break;
+                bytes.append(chunk.data(), chunk.size());
+                reader.advance(chunk.size());
+            }
+            SnapshotHeader header = readHeader(bytes, fileName);
+            doc->rootOffset = header.rootOffset;
+            std::memcpy(doc->arena.at(doc->arena.allocate(header.dataSize)), bytes.data() + sizeof(header),
+                        header.dataSize);
+            return doc;
+        }
+
+        const Node& root() const {
+            return *reinterpret_cast<const Node*>(at(rootOffset));
+        }
+
+        // First element of an ARRAY, or first key of an OBJECT (value at +1,
+        // next key at +2).
+        const Node* children(const Node& node) const {
+            return reinterpret_cast<const Node*>(at(node.payload));
+        }
+
+        std::string_view getString(const Node& node) const {
+            return std::string_view(at(node.payload), node.length);
+        }
+
+        jsontok::NumberValue getNumber(const Node& node) const {
+            return jsontok::NumberValue::fromBits(static_cast<jsontok::NumberKind>(node.numberKind), node.payload);
+        }
+
+        bool getBool(const Node& node) const {
+            return node.payload != 0;
+        }
+
+        // Value stored under key in an OBJECT node, or nullptr. With several
+        // equal keys, the first one wins.
+        const Node* findMember(const Node& node, std::string_view key) const {
+            const Node* member = children(node);
+            if (node.length < jsonparse::JsonObject::INDEX_THRESHOLD) {
+                for (uint64_t i = 0; i < node.length; i++, member += 2) {
+                    if (getString(member[0]) == key)
+                        return member + 1;
+                }
+                return nullptr;
+            }
+            const uint32_t* table = reinterpret_cast<const uint32_t*>(member + node.length * 2);
+            size_t mask = jsonparse::keyTableSize(node.length) - 1;
+            for (size_t slot = jsonparse::hashKey(key) & mask;; slot = (slot + 1) & mask) {
+                uint32_t entry = table[slot];
+                if (entry == 0)
+                    return nullptr;
+                if (getString(member[(entry - 1) * 2]) == key)
+                    return member + (entry - 1) * 2 + 1;
+            }
+        }
+
+        // Bytes held by the document, all in one allocation. A mapped
+        // snapshot counts its whole mapping, though the OS only keeps the
+        // pages that were touched resident.
+        size_t memoryUsage() const {
+            return sizeof(Document) + (mapping ? mapping->size() : arena.allocated());
+        }
+    };
+
+    // Writes a value of either tree as a snapshot Document::openSnapshot can
+    // map. The value is laid out again in a fresh arena rather than dumped
+    // as is: containers are packed without the slack of arena growth, and
+    // equal strings, repeated keys above all, are stored once and shared.
+    // Numbers keep their parsed bits, so nothing is reparsed on load.
+    class SnapshotWriter {
+    private:
+        Arena arena;
+        std::unordered_map<std::string_view, uint64_t> strings;
+
+        uint64_t intern(std::string_view text) {
+            auto found = strings.find(text);
+            if (found != strings.end())
+                return found->second;
+            uint64_t offset = arena.store(text);
+            strings.emplace(text, offset);
+            return offset;
+        }
+
+        void put(uint64_t offset, const Node& node) {
+            std::memcpy(arena.at(offset), &node, sizeof(Node));
+        }
+
+        static size_t tableBytes(const Node& node) {
+            if (node.getObjType() != jsonparse::JsonObjectType::OBJECT ||
+                node.length < jsonparse::JsonObject::INDEX_THRESHOLD)
+                return 0;
+            return jsonparse::keyTableSize(node.length) * sizeof(uint32_t);
+        }
+
+        Node copy(const Document& source, const Node& node) {
+            Node out = node;
+            if (node.isLiteral(jsonparse::LiteralType::STRING)) {
+                out.payload = intern(source.getString(node));
+                return out;
+            }
+            if (node.getObjType() == jsonparse::JsonObjectType::LITERAL)
+                return out;
+            size_t count = node.getObjType() == jsonparse::JsonObjectType::OBJECT ? node.length * 2 : node.length;
+            size_t table = tableBytes(node);
+            out.payload = arena.allocate(count * sizeof(Node) + table);
+            const Node* child = source.children(node);
+            // Key tables hold member indexes only, so they copy as they are.
+            if (table > 0)
+                std::memcpy(arena.at(out.payload + count * sizeof(Node)), child + count, table);
+            for (size_t i = 0; i < count; i++)
+                put(out.payload + i * sizeof(Node), copy(source, child[i]));
+            return out;
+        }
+
+        Node makeString(std::string_view text) {
+            Node node = {};
+            node.objType = static_cast<uint8_t>(jsonparse::JsonObjectType::LITERAL);
+            node.literalType = static_cast<uint8_t>(jsonparse::LiteralType::STRING);
+            node.length = text.size();
+            node.payload = intern(text);
+            return node;
+        }
+
+        Node copy(const jsonparse::JPtr& value) {
+            Node out = {};
+            out.objType = static_cast<uint8_t>(value->getObjType());
+            switch (value->getObjType()) {
+                case jsonparse::JsonObjectType::OBJECT: {
+                    const auto& pairs = static_cast<const jsonparse::JsonObject*>(value.get())->getKeyPairs();
+                    out.length = pairs.size();
+                    out.payload = arena.allocate(pairs.size() * 2 * sizeof(Node) + tableBytes(out));
+                    for (size_t i = 0; i < pairs.size(); i++) {
+                        put(out.payload + i * 2 * sizeof(Node), makeString(pairs[i].first));
+                        put(out.payload + (i * 2 + 1) * sizeof(Node), copy(pairs[i].second));
+                    }
+                    if (tableBytes(out) > 0)
+                        buildKeyTable(arena, out);
+                    return out;
+                }
+                case jsonparse::JsonObjectType::ARRAY: {
+                    const auto& values = static_cast<const jsonparse::JsonArray*>(value.get())->getArrayVals();
+                    out.length = values.size();
+                    out.payload = arena.allocate(values.size() * sizeof(Node));
+                    for (size_t i = 0; i < values.size(); i++)
+                        put(out.payload + i * sizeof(Node), copy(values[i]));
+                    return out;
+                }
+                default:
+                    break;
+            }
+            const auto* literal = static_cast<const jsonparse::JsonLiteral*>(value.get());
+            switch (literal->getLiteralType()) {
+                case jsonparse::LiteralType::STRING:
+                    return makeString(static_cast<const jsonparse::JsonString*>(literal)->getValue());
+                case jsonparse::LiteralType::NUMBER: {
+                    jsontok::NumberValue number = static_cast<const jsonparse::JsonNumber*>(literal)->getNumberValue();
+                    out.literalType = static_cast<uint8_t>(jsonparse::LiteralType::NUMBER);
+                    out.numberKind = static_cast<uint8_t>(number.getKind());
+                    out.payload = number.getBits();
+                    return out;
+                }
+                case jsonparse::LiteralType::BOOL:
+                    out.literalType = static_cast<uint8_t>(jsonparse::LiteralType::BOOL);
+                    out.payload = static_cast<const jsonparse::JsonBool*>(literal)->getValue() ? 1 : 0;
+                    return out;
+                default:
+                    out.literalType = static_cast<uint8_t>(jsonparse::LiteralType::NULL_VAL);
+                    return out;
+            }
+        }
+
+        void writeFile(const std::string& fileName, const Node& top) {
+            SnapshotHeader header = {};
+            std::memcpy(header.magic, "JDOM", 4);
+            header.version = SnapshotHeader::VERSION;
+            header.endianMark = SnapshotHeader::ENDIAN_MARK;
+            header.nodeSize = sizeof(Node);
+            header.rootOffset = arena.allocate(sizeof(Node));
+            put(header.rootOffset, top);
+            header.dataSize = arena.size();
+            fileutils::OutputFileWriter out(fileName);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(arena.at(0), arena.size());
+        }
+
+    public:
+        // Saves node and everything below it.
+        static void save(const Document& source, const Node& node, const std::string& fileName) {
+            SnapshotWriter writer;
+            Node top = writer.copy(source, node);
+            writer.writeFile(fileName, top);
+        }
+
+        static void save(const jsonparse::JPtr& root, const std::string& fileName) {
+            SnapshotWriter writer;
+            Node top = writer.copy(root);
+            writer.writeFile(fileName, top);
+        }
+    };
+
+    // Builds a Document with the same grammar as jsonparse::JsonParser.
+    // Children are collected on one shared scratch stack and copied into the
+    // arena as a contiguous run when their container closes.
+    class DocumentParser {
+    private:
+        Document& doc;
+        std::vector<Node> scratch;
+        jsonparse::MemoryBudget* budget;
+
+        static void throwError(const std::string& where,
+                               const std::string& expected,
+                               const jsontok::Token& found)
+        {
+            std::string msg =
+                "\n[JSON Parse Error]\n"
+                "Location: " + where + "\n"
+                "Expected: " + expected + "\n"
+                "Found Token: '" + std::string(found.getRawTokenValue()) + "'\n"
+                "TokenType: " + std::to_string(static_cast<int>(found.getTokenType())) + "\n";
+
+            throw std::runtime_error(msg);
+        }
+
+        static Node makeNode(jsonparse::JsonObjectType objType,
+                             jsonparse::LiteralType literalType = jsonparse::LiteralType::NULL_VAL) {
+            JSONSTATS_COUNT_NODE(objType);
+            Node node = {};
+            node.objType = static_cast<uint8_t>(objType);
+            node.literalType = static_cast<uint8_t>(literalType);
+            return node;
+        }
+
+        // Scratch growth counts against the budget too: it peaks alongside
+        // the arena.
+        void pushScratch(const Node& node) {
+            if (budget && scratch.size() == scratch.capacity())
+                budget->charge(std::max<size_t>(scratch.capacity(), 1) * sizeof(Node));
+            scratch.push_back(node);
+        }
+
+        Node makeString(std::string_view text) {
+            Node node = makeNode(jsonparse::JsonObjectType::LITERAL, jsonparse::LiteralType::STRING);
+            node.length = text.size();
+            node.payload = doc.arena.store(text);
+            return node;
+        }
+
+        // Moves scratch[from..] into the arena, reserving tableBytes right
+        // after it, and returns its offset.
+        uint64_t commitChildren(size_t from, size_t tableBytes = 0) {
+            size_t count = scratch.size() - from;
+            size_t offset = doc.arena.allocate(count * sizeof(Node) + tableBytes);
+            if (count > 0)
+                std::memcpy(doc.arena.at(offset), scratch.data() + from, count * sizeof(Node));
+            scratch.resize(from);
+            return offset;
+        }
+
+        // Parses the literal, array or object at the tokenizer into a node.
+        Node parseValue(jsontok::JsonOnDemandTokenizer& tokenizer, const char* where) {
+            jsontok::Token tok = tokenizer.peekNextToken();
+            switch (tok.getTokenType()) {
+                case jsontok::TokenType::OPEN_BRACE:
+                    return parseObject(tokenizer);
+                case jsontok::TokenType::OPEN_BRACK:
+                    return parseArray(tokenizer);
+                case jsontok::TokenType::STRING: {
+                    Node node = makeString(tok.getRawTokenValue());
+                    tokenizer.getNextToken();
+                    return node;
+                }
+                case jsontok::TokenType::NUMBER: {
+                    Node node = makeNode(jsonparse::JsonObjectType::LITERAL, jsonparse::LiteralType::NUMBER);
+                    node.numberKind = static_cast<uint8_t>(tok.getNumberValue().getKind());
+                    node.payload = tok.getNumberValue().getBits();
+                    tokenizer.getNextToken();
+                    return node;
+                }
+                case jsontok::TokenType::BOOL: {
+                    Node node = makeNode(jsonparse::JsonObjectType::LITERAL, jsonparse::LiteralType::BOOL);
+                    node.payload = tok.getRawTokenValue() == "true" ? 1 : 0;
+                    tokenizer.getNextToken();
+                    return node;
+                }
+                case jsontok::TokenType::NULL_VAL: {
+                    tokenizer.getNextToken();
+                    return makeNode(jsonparse::JsonObjectType::LITERAL, jsonparse::LiteralType::NULL_VAL);
+                }
+                default:
+                    throwError(where, "literal | array | object", tok);
+            }
+            return Node();
+        }
+
+        Node parseObject(jsontok::JsonOnDemandTokenizer& tokenizer) {
+            size_t from = scratch.size();
+            tokenizer.getNextToken(); // consumes '{'
+
+            while (true) {
+                jsontok::Token currentTok = tokenizer.getNextToken();
+                if (currentTok.getTokenType() == jsontok::TokenType::CLOSE_BRACE)
+                    break;
+                if (currentTok.getTokenType() != jsontok::TokenType::STRING)
+                    throwError("parseObject(): reading key", "STRING (object key)", currentTok);
+                pushScratch(makeString(currentTok.getRawTokenValue()));
+
+                currentTok = tokenizer.getNextToken();
+                if (currentTok.getTokenType() != jsontok::TokenType::COLON)
+                    throwError("parseObject(): after key", "COLON ':'", currentTok);
+
+                pushScratch(parseValue(tokenizer, "parseObject(): value"));
+
+                currentTok = tokenizer.getNextToken();
+                if (currentTok.getTokenType() == jsontok::TokenType::CLOSE_BRACE)
+                    break;
+                if (currentTok.getTokenType() != jsontok::TokenType::COMMA)
+                    throwError("parseObject(): expecting comma between pairs", "',' or '}'", currentTok);
+            }
+
+            Node node = makeNode(jsonparse::JsonObjectType::OBJECT);
+            node.length = (scratch.size() - from) / 2;
+            if (node.length < jsonparse::JsonObject::INDEX_THRESHOLD) {
+                node.payload = commitChildren(from);
+                return node;
+            }
+            node.payload = commitChildren(from, jsonparse::keyTableSize(node.length) * sizeof(uint32_t));
+            buildKeyTable(doc.arena, node);
+            return node;
+        }
+
+        Node parseArray(jsontok::JsonOnDemandTokenizer& tokenizer) {
+            size_t from = scratch.size();
+            tokenizer.getNextToken(); // consumes '['
+
+            while (true) {
+                if (tokenizer.peekNextToken().getTokenType() == jsontok::TokenType::CLOSE_BRACK) {
+                    tokenizer.getNextToken();
+                    break;
+                }
+                pushScratch(parseValue(tokenizer, "parseArray(): value"));
+
+                jsontok::Token currentTok = tokenizer.getNextToken();
+                if (currentTok.getTokenType() == jsontok::TokenType::CLOSE_BRACK)
+                    break;
+                if (currentTok.getTokenType() != jsontok::TokenType::COMMA)
+                    throwError("parseArray(): expecting comma between values", "',' or ']'", currentTok);
+            }
+
+            Node node = makeNode(jsonparse::JsonObjectType::ARRAY);
+            node.length = scratch.size() - from;
+            node.payload = commitChildren(from);
+            return node;
+        }
+
+        DocumentParser(Document& target, jsonparse::MemoryBudget* limit) : doc(target), budget(limit) {}
+
+    public:
+        // With a budget, arena and scratch growth are charged before they
+        // happen and MemoryBudgetExceeded is thrown instead.
+        static std::shared_ptr<Document> startParsing(jsontok::JsonOnDemandTokenizer& tokenizer,
+                                                      jsonparse::MemoryBudget* budget = nullptr) {
+            JSONSTATS_PHASE(BUILD);
+            auto doc = std::make_shared<Document>();
+            DocumentParser parser(*doc, budget);
+            if (budget)
+                budget->charge(sizeof(Document));
+            doc->arena.setBudget(budget);
+
+            jsontok::Token peek = tokenizer.peekNextToken();
+            if (peek.getTokenType() != jsontok::TokenType::OPEN_BRACE &&
+                peek.getTokenType() != jsontok::TokenType::OPEN_BRACK) {
+                throwError("startParsing()", "{ or [", peek);
+            }
+            Node root = parser.parseValue(tokenizer, "startParsing()");
+            doc->rootOffset = doc->arena.allocate(sizeof(Node));
+            std::memcpy(doc->arena.at(doc->rootOffset), &root, sizeof(Node));
+            doc->arena.setBudget(nullptr);
+            return doc;
+        }
+    };
+}
@@ -1,17 +1,875 @@
 #pragma once
 #include "fileutils.hpp"
+#include "jsonsimd.hpp"
+#include "jsonstats.hpp"
+#include "jsontok.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 namespace jsonfmt{
+    // '\n' followed by enough spaces for the deepest level seen so far, so a
+    // line break plus any indentation is a single slice of one buffer.
+    class IndentTable{
+        private:
+            static const long INITIAL_LEVELS = 64;
+            std::string table;
+            size_t width;
+
+        public:
+            IndentTable(int indent) : width(indent > 0 ? indent : 0){
+                table.assign(1 + INITIAL_LEVELS * width, ' ');
+                table[0] = '\n';
+            }
+
+            std::string_view newLine(long level){
+                size_t len = level > 0 ? static_cast<size_t>(level) * width : 0;
+                if(table.size() < len + 1){
+                    table.resize(std::max(len + 1, table.size() * 2), ' ');
+                }
+                return std::string_view(table.data(), len + 1);
+            }
+
+            std::string_view indentation(long level){
+                return newLine(level).substr(1);
+            }
+    };
+
+    // JSON Pointer (RFC 6901) paths compiled into a trie of reference
+    // tokens. As an extension, a "*" token matches every member or element.
+    // The trie is kept deterministic: where a key or index is matched both by
+    // its own token and by "*", the paths below the two are merged into one
+    // node, so every lookup follows a single edge.
+    class PointerSet{
+        public:
+            static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+        private:
+            struct Node{
+                std::vector<std::string> tokens;
+                std::vector<size_t> indices; // token as an array index, or SIZE_MAX
+                std::vector<uint32_t> targets;
+                uint32_t wildcard = NONE;    // target of a "*" token
+                std::vector<uint32_t> pointers; // add() ids of the paths ending here
+            };
+            // The paths as added; nodes is compiled from them.
+            std::vector<Node> patterns;
+            std::vector<Node> nodes;
+            uint32_t pointerCount = 0;
+
+            static size_t arrayIndex(std::string_view token){
+                if(token.empty() || token.size() > 18 || (token[0] == '0' && token.size() > 1)){
+                    return SIZE_MAX;
+                }
+                size_t index = 0;
+                for(char ch : token){
+                    if(ch < '0' || ch > '9'){
+                        return SIZE_MAX;
+                    }
+                    index = index * 10 + static_cast<size_t>(ch - '0');
+                }
+                return index;
+            }
+
+            static uint32_t tokenChild(const Node& n, std::string_view token){
+                for(size_t i = 0; i < n.tokens.size(); i++){
+                    if(n.tokens[i] == token){
+                        return n.targets[i];
+                    }
+                }
+                return NONE;
+            }
+
+            uint32_t addPattern(std::string_view pointer){
+                uint32_t node = 0;
+                for(std::string& token : parsePointer(pointer)){
+                    uint32_t next = token == "*" ? patterns[node].wildcard : tokenChild(patterns[node], token);
+                    if(next == NONE){
+                        next = static_cast<uint32_t>(patterns.size());
+                        if(token == "*"){
+                            patterns[node].wildcard = next;
+                        }
+                        else{
+                            patterns[node].indices.push_back(arrayIndex(token));
+                            patterns[node].tokens.push_back(std::move(token));
+                            patterns[node].targets.push_back(next);
+                        }
+                        patterns.emplace_back();
+                    }
+                    node = next;
+                }
+                patterns[node].pointers.push_back(pointerCount);
+                return pointerCount++;
+            }
+
+            // Subset construction: each node stands for the set of pattern
+            // nodes a path can have reached. A token's edge leads to the
+            // union of those tokens' targets and all "*" targets; the "*"
+            // edge, taken by anything else, to the "*" targets alone.
+            void compile(){
+                nodes.clear();
+                std::vector<std::vector<uint32_t>> sets;
+                std::map<std::vector<uint32_t>, uint32_t> known;
+                auto nodeFor = [&](std::vector<uint32_t> set){
+                    std::sort(set.begin(), set.end());
+                    set.erase(std::unique(set.begin(), set.end()), set.end());
+                    auto found = known.find(set);
+                    if(found != known.end()){
+                        return found->second;
+                    }
+                    uint32_t id = static_cast<uint32_t>(nodes.size());
+                    known.emplace(set, id);
+                    sets.push_back(std::move(set));
+                    nodes.emplace_back();
+                    return id;
+                };
+                nodeFor({0});
+                for(size_t id = 0; id < sets.size(); id++){
+                    std::vector<uint32_t> set = sets[id];
+                    std::vector<uint32_t> wildcards;
+                    std::vector<std::string> tokens;
+                    std::vector<uint32_t> pointers;
+                    for(uint32_t p : set){
+                        const Node& pattern = patterns[p];
+                        pointers.insert(pointers.end(), pattern.pointers.begin(), pattern.pointers.end());
+                        if(pattern.wildcard != NONE){
+                            wildcards.push_back(pattern.wildcard);
+                        }
+                        for(const std::string& token : pattern.tokens){
+                            if(std::find(tokens.begin(), tokens.end(), token) == tokens.end()){
+                                tokens.push_back(token);
+                            }
+                        }
+                    }
+                    std::sort(pointers.begin(), pointers.end());
+                    nodes[id].pointers = std::move(pointers);
+                    for(const std::string& token : tokens){
+                        std::vector<uint32_t> targets = wildcards;
+                        for(uint32_t p : set){
+                            uint32_t child = tokenChild(patterns[p], token);
+                            if(child != NONE){
+                                targets.push_back(child);
+                            }
+                        }
+                        uint32_t target = nodeFor(std::move(targets));
+                        nodes[id].indices.push_back(arrayIndex(token));
+                        nodes[id].tokens.push_back(token);
+                        nodes[id].targets.push_back(target);
+                    }
+                    if(!wildcards.empty()){
+                        uint32_t target = nodeFor(std::move(wildcards));
+                        nodes[id].wildcard = target;
+                    }
+                }
+            }
+
+        public:
+            // "" is the whole document; otherwise each token follows a '/',
+            // with "~1" standing for '/' and "~0" for '~'.
+            static std::vector<std::string> parsePointer(std::string_view pointer){
+                std::vector<std::string> tokens;
+                if(pointer.empty()){
+                    return tokens;
+                }
+                if(pointer[0] != '/'){
+                    throw std::runtime_error("Invalid JSON Pointer (must start with '/'): " + std::string(pointer));
+                }
+                for(size_t pos = 1; ; ){
+                    size_t end = std::min(pointer.find('/', pos), pointer.size());
+                    std::string token;
+                    for(size_t i = pos; i < end; i++){
+                        if(pointer[i] != '~'){
+                            token += pointer[i];
+                        }
+                        else if(i + 1 < end && (pointer[i + 1] == '0' || pointer[i + 1] == '1')){
+                            token += pointer[++i] == '0' ? '~' : '/';
+                        }
+                        else{
+                            throw std::runtime_error("Invalid escape in JSON Pointer: " + std::string(pointer));
+                        }
+                    }
+                    tokens.push_back(std::move(token));
+                    if(end == pointer.size()){
+                        return tokens;
+                    }
+                    pos = end + 1;
+                }
+            }
+
+            explicit PointerSet(const std::vector<std::string>& pointers = {}) : patterns(1){
+                for(const std::string& pointer : pointers){
+                    addPattern(pointer);
+                }
+                compile();
+            }
+
+            // Selects one more path and returns its id: the number of paths
+            // added before it.
+            uint32_t add(std::string_view pointer){
+                uint32_t id = addPattern(pointer);
+                compile();
+                return id;
+            }
+
+            uint32_t root() const{
+                return 0;
+            }
+
+            // Node ids run from 0 to size() - 1.
+            size_t size() const{
+                return nodes.size();
+            }
+
+            bool hasChildren(uint32_t node) const{
+                return !nodes[node].tokens.empty() || nodes[node].wildcard != NONE;
+            }
+
+            // The whole subtree at node is wanted.
+            bool selected(uint32_t node) const{
+                return node != NONE && !nodes[node].pointers.empty();
+            }
+
+            // Ids of the paths that end at node, in the order they were added.
+            const std::vector<uint32_t>& pointers(uint32_t node) const{
+                return nodes[node].pointers;
+            }
+
+            // Node for an object member, by its raw key; NONE if no path
+            // goes through it.
+            uint32_t memberChild(uint32_t node, std::string_view key) const{
+                const Node& n = nodes[node];
+                for(size_t i = 0; i < n.tokens.size(); i++){
+                    if(n.tokens[i] == key){
+                        return n.targets[i];
+                    }
+                }
+                return n.wildcard;
+            }
+
+            uint32_t elementChild(uint32_t node, size_t index) const{
+                const Node& n = nodes[node];
+                for(size_t i = 0; i < n.tokens.size(); i++){
+                    if(n.indices[i] == index){
+                        return n.targets[i];
+                    }
+                }
+                return n.wildcard;
+            }
+    };
+
+    // Streaming filter that keeps only the subtrees a PointerSet selects,
+    // minified, along with the objects and arrays that lead to them; arrays
+    // keep the selected elements in order. Input is walked from structural
+    // character to structural character, found a block at a time as in
+    // jsonindex: pruned subtrees are passed over by counting brackets and
+    // their text is never looked at, and only keys (and scalars that are
+    // selected) are gathered. Memory is the open path plus one token. The
+    // input is assumed to be valid JSON with an object or array at the root;
+    // anything after the root is ignored.
+    template<typename Writer>
+    class PathProjector{
+        private:
+            enum class Mode{
+                NAVIGATE, // in a container on a selected path
+                COPY,     // inside a selected container
+                SKIP,     // inside a pruned container
+                DONE      // past the root
+            };
+            struct Frame{
+                bool object;
+                uint32_t node;
+                uint32_t child;  // node of the member or element being read
+                bool opened;     // its opening bracket has been written
+                size_t written;  // members or elements written
+                size_t index;
+                std::string key; // raw, quotes included
+            };
+
+            const PointerSet& paths;
+            Writer& out;
+            jsonsimd::StringTracker tracker;
+            jsonsimd::SimdLevel level;
+            std::vector<Frame> frames;
+            Mode mode = Mode::NAVIGATE;
+            size_t depth = 0;        // COPY and SKIP: brackets open
+            bool keepSpan = true;    // NAVIGATE: the text up to the next structural character is needed
+            bool spanAtStart = true; // COPY: nothing of the current text written yet
+            std::string carry;       // NAVIGATE: needed text from earlier blocks
+            char block[jsonsimd::BLOCK_SIZE];
+            size_t blockFill = 0;
+
+            static bool isSpace(char ch){
+                return ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t';
+            }
+
+            static std::string_view trim(std::string_view text){
+                size_t from = 0;
+                size_t to = text.size();
+                while(from < to && isSpace(text[from])){
+                    from++;
+                }
+                while(to > from && isSpace(text[to - 1])){
+                    to--;
+                }
+                return text.substr(from, to - from);
+            }
+
+            // Writes the text of a copied value between structural characters.
+            // That text is at most one token, so dropping whitespace at its
+            // ends minifies it; trailing whitespace is kept while the token is
+            // a string cut by the end of a block.
+            void copyText(std::string_view text, bool last){
+                size_t from = 0;
+                size_t to = text.size();
+                if(spanAtStart){
+                    while(from < to && isSpace(text[from])){
+                        from++;
+                    }
+                }
+                if(last || !tracker.inString()){
+                    while(to > from && isSpace(text[to - 1])){
+                        to--;
+                    }
+                }
+                if(from < to){
+                    out.write(text.data() + from, to - from);
+                    spanAtStart = false;
+                }
+            }
+
+            void writeMemberPrefix(Frame& parent){
+                if(parent.written++ > 0){
+                    out.pushChar(',');
+                }
+                if(parent.object){
+                    out.write(parent.key);
+                    out.pushChar(':');
+                }
+            }
+
+            // Writes whatever has not been written yet of the path to the
+            // value about to be copied.
+            void beginValue(){
+                for(size_t i = 0; i < frames.size(); i++){
+                    Frame& frame = frames[i];
+                    if(frame.opened){
+                        continue;
+                    }
+                    if(i > 0){
+                        writeMemberPrefix(frames[i - 1]);
+                    }
+                    out.pushChar(frame.object ? '{' : '[');
+                    frame.opened = true;
+                }
+                writeMemberPrefix(frames.back());
+            }
+
+            void pushFrame(bool object, uint32_t node){
+                frames.push_back(Frame{object, node, PointerSet::NONE, false, 0, 0, std::string()});
+                if(!object){
+                    frames.back().child = paths.elementChild(node, 0);
+                }
+                keepSpan = object || paths.selected(frames.back().child);
+            }
+
+            void finishScalar(const Frame& frame, std::string_view text){
+                std::string_view value = trim(text);
+                if(!value.empty() && paths.selected(frame.child)){
+                    beginValue();
+                    out.write(value);
+                }
+            }
+
+            void navigate(char ch, std::string_view text){
+                if(frames.empty()){
+                    if((ch != '{' && ch != '[') || !trim(text).empty()){
+                        throw std::runtime_error("JSON projection: the root must be an object or array");
+                    }
+                    if(paths.selected(paths.root())){
+                        out.pushChar(ch);
+                        mode = Mode::COPY;
+                        depth = 1;
+                        spanAtStart = true;
+                        return;
+                    }
+                    pushFrame(ch == '{', paths.root());
+                    return;
+                }
+                Frame& frame = frames.back();
+                switch(ch){
+                    case ':': {
+                        std::string_view key = trim(text);
+                        if(!frame.object || key.size() < 2 || key.front() != '\"' || key.back() != '\"'){
+                            throw std::runtime_error("JSON projection: expected a key before ':'");
+                        }
+                        frame.key.assign(key.data(), key.size());
+                        std::string_view name = key.substr(1, key.size() - 2);
+                        if(name.find('\\') != std::string_view::npos){
+                            frame.child = paths.memberChild(frame.node, jsontok::unescapeString(name));
+                        }
+                        else{
+                            frame.child = paths.memberChild(frame.node, name);
+                        }
+                        keepSpan = paths.selected(frame.child);
+                        break;
+                    }
+                    case '{':
+                    case '[':
+                        if(frame.child == PointerSet::NONE){
+                            mode = Mode::SKIP;
+                            depth = 1;
+                        }
+                        else if(paths.selected(frame.child)){
+                            beginValue();
+                            out.pushChar(ch);
+                            mode = Mode::COPY;
+                            depth = 1;
+                            spanAtStart = true;
+                        }
+                        else{
+                            pushFrame(ch == '{', frame.child);
+                        }
+                        break;
+                    case ',':
+                        finishScalar(frame, text);
+                        if(frame.object){
+                            frame.child = PointerSet::NONE;
+                            keepSpan = true;
+                        }
+                        else{
+                            frame.child = paths.elementChild(frame.node, ++frame.index);
+                            keepSpan = paths.selected(frame.child);
+                        }
+                        break;
+                    default: {
+                        if(frame.object != (ch == '}')){
+                            throw std::runtime_error(std::string("JSON projection: unexpected '") + ch + "'");
+                        }
+                        finishScalar(frame, text);
+                        char opener = frame.object ? '{' : '[';
+                        if(!frame.opened && frames.size() == 1){
+                            out.pushChar(opener);
+                            frame.opened = true;
+                        }
+                        if(frame.opened){
+                            out.pushChar(ch);
+                        }
+                        frames.pop_back();
+                        if(frames.empty()){
+                            mode = Mode::DONE;
+                        }
+                        keepSpan = false;
+                    }
+                }
+            }
+
+            void onStructural(char ch, std::string_view text){
+                switch(mode){
+                    case Mode::NAVIGATE:
+                        if(!carry.empty()){
+                            carry.append(text.data(), text.size());
+                            text = carry;
+                        }
+                        navigate(ch, text);
+                        carry.clear();
+                        return;
+                    case Mode::COPY:
+                        copyText(text, true);
+                        out.pushChar(ch);
+                        spanAtStart = true;
+                        if(ch == '{' || ch == '['){
+                            depth++;
+                        }
+                        else if((ch == '}' || ch == ']') && --depth == 0){
+                            mode = frames.empty() ? Mode::DONE : Mode::NAVIGATE;
+                            keepSpan = false;
+                        }
+                        return;
+                    case Mode::SKIP:
+                        if(ch == '{' || ch == '['){
+                            depth++;
+                        }
+                        else if((ch == '}' || ch == ']') && --depth == 0){
+                            mode = Mode::NAVIGATE;
+                            keepSpan = false;
+                        }
+                        return;
+                    default:
+                        return;
+                }
+            }
+
+            // Whole blocks at data; only the first len bytes are input, the
+            // rest of the last block is padding.
+            void processBlocks(const char* data, size_t len){
+                size_t textFrom = 0;
+                for(size_t pos = 0; pos < len; pos += jsonsimd::BLOCK_SIZE){
+                    jsonsimd::StructuralMasks masks = jsonsimd::classifyStructural(data + pos, level);
+                    uint64_t structural = masks.structural & ~tracker.next(masks.quote, masks.backslash);
+                    while(structural != 0 && mode != Mode::DONE){
+                        size_t at = pos + __builtin_ctzll(structural);
+                        structural &= structural - 1;
+                        onStructural(data[at], std::string_view(data + textFrom, at - textFrom));
+                        textFrom = at + 1;
+                    }
+                }
+                std::string_view rest(data + textFrom, len - textFrom);
+                if(mode == Mode::COPY){
+                    copyText(rest, false);
+                }
+                else if(mode == Mode::NAVIGATE && keepSpan){
+                    carry.append(rest.data(), rest.size());
+                }
+            }
+
+        public:
+            PathProjector(const PointerSet& selection, Writer& target, jsonsimd::SimdLevel simd = jsonsimd::simdLevel())
+            : paths(selection), out(target), level(simd){}
+
+            // Input in order, in pieces of any size.
+            void feed(const char* data, size_t len){
+                size_t pos = 0;
+                if(blockFill > 0){
+                    size_t take = std::min(jsonsimd::BLOCK_SIZE - blockFill, len);
+                    std::memcpy(block + blockFill, data, take);
+                    blockFill += take;
+                    pos += take;
+                    if(blockFill < jsonsimd::BLOCK_SIZE){
+                        return;
+                    }
+                    processBlocks(block, jsonsimd::BLOCK_SIZE);
+                    blockFill = 0;
+                }
+                size_t whole = (len - pos) / jsonsimd::BLOCK_SIZE * jsonsimd::BLOCK_SIZE;
+                if(whole > 0){
+                    processBlocks(data + pos, whole);
+                    pos += whole;
+                }
+                std::memcpy(block, data + pos, len - pos);
+                blockFill = len - pos;
+            }
+
+            // True once the root has been closed; the rest of the input can
+            // be dropped.
+            bool done() const{
+                return mode == Mode::DONE;
+            }
+
+            void finish(){
+                if(blockFill > 0 && mode != Mode::DONE){
+                    std::memset(block + blockFill, ' ', jsonsimd::BLOCK_SIZE - blockFill);
+                    processBlocks(block, blockFill);
+                    blockFill = 0;
+                }
+                if(mode != Mode::DONE){
+                    throw std::runtime_error("JSON projection: unexpected end of input");
+                }
+            }
+    };
+
     class JsonFormat{
         private:
             enum class context{
                 NORMAL,
                 STRING
             };
-            context cntx = context::NORMAL;
+            // Line break owed before the next printable token: NEWLINE means
+            // '\n' and indentation are both pending, INDENT means the '\n' has
+            // already gone out (e.g. an empty container was closed).
+            enum class lineState{
+                NONE,
+                NEWLINE,
+                INDENT
+            };
+            // Everything formatting needs to resume at an arbitrary byte.
+            struct FormatState{
+                context cntx = context::NORMAL;
+                int isEscapedChar = 0;
+                long level = 0;
+                lineState pending = lineState::NONE;
+            };
+            // What a chunk does to the format state, computed for one assumed
+            // starting context. lastBreak is the last token that set (NEWLINE)
+            // or cleared (NONE) the pending line break, INDENT if there was none.
+            struct ChunkSummary{
+                bool endsInString = false;
+                long levelDelta = 0;
+                lineState lastBreak = lineState::INDENT;
+                bool closedAfterBreak = false;
+            };
+            static const size_t PARALLEL_CHUNK_SIZE = 4 << 20;
+
             fileutils::InputFileReader inputJson;
             fileutils::OutputFileWriter outPutJson;
 
+            template<typename Writer>
+            static void breakLine(lineState& pending, long level, IndentTable& indentTable, Writer& out){
+                if(pending == lineState::NEWLINE){
+                    out.write(indentTable.newLine(level));
+                }
+                else if(pending == lineState::INDENT){
+                    out.write(indentTable.indentation(level));
+                }
+                pending = lineState::NONE;
+            }
+
+            template<typename Writer>
+            static void settleNewLine(lineState& pending, Writer& out){
+                if(pending == lineState::NEWLINE){
+                    out.pushChar('\n');
+                    pending = lineState::INDENT;
+                }
+            }
+
+            static bool isFormatDelimiter(char ch){
+                switch(ch){
+                    case '{': case '[': case '}': case ']':
+                    case ':': case ',': case '\"':
+                    case ' ': case '\n': case '\t':
+                        return true;
+                    default:
+                        return false;
+                }
+            }
+
+            template<typename Writer>
+            static void formatSpan(const char* data, size_t len, FormatState& state, IndentTable& indentTable, Writer& out){
+                size_t pos = 0;
+                while(pos < len){
+                    if(state.cntx == context::STRING){
+                        // Copy the string body through up to and including its closing quote.
+                        size_t start = pos;
+                        while(pos < len){
+                            char nextChar = data[pos++];
+                            if(state.isEscapedChar){
+                                state.isEscapedChar = 0;
+                            }
+                            else if(nextChar == '\\'){
+                                state.isEscapedChar = 1;
+                            }
+                            else if(nextChar == '\"'){
+                                state.cntx = context::NORMAL;
+                                break;
+                            }
+                        }
+                        out.write(data + start, pos - start);
+                        continue;
+                    }
+                    char nextChar = data[pos];
+                    switch(nextChar){
+                        case '{':
+                        case '[':
+                            breakLine(state.pending, state.level, indentTable, out);
+                            out.pushChar(nextChar);
+                            state.pending = lineState::NEWLINE;
+                            state.level += 1;
+                            pos += 1;
+                            break;
+                        case ':':
+                            settleNewLine(state.pending, out);
+                            out.write(": ", 2);
+                            pos += 1;
+                            break;
+                        case ' ':
+                        case '\n':
+                        case '\t':
+                            pos += 1;
+                            break;
+                        case '}':
+                        case ']':
+                            settleNewLine(state.pending, out);
+                            state.level -= 1;
+                            out.write(indentTable.newLine(state.level));
+                            out.pushChar(nextChar);
+                            pos += 1;
+                            break;
+                        case ',':
+                            if(state.pending == lineState::NEWLINE){
+                                out.pushChar('\n');
+                            }
+                            out.pushChar(',');
+                            state.pending = lineState::NEWLINE;
+                            pos += 1;
+                            break;
+                        case '\"':
+                            breakLine(state.pending, state.level, indentTable, out);
+                            out.pushChar('\"');
+                            state.cntx = context::STRING;
+                            pos += 1;
+                            break;
+                        default:{
+                            // Numbers, literals and anything else are copied as one run.
+                            breakLine(state.pending, state.level, indentTable, out);
+                            size_t start = pos;
+                            while(pos < len && !isFormatDelimiter(data[pos])){
+                                pos += 1;
+                            }
+                            out.write(data + start, pos - start);
+                            break;
+                        }
+                    }
+                }
+            }
+
+            // First pass of the parallel formatter: the same decisions as
+            // formatSpan, but only recording their net effect.
+            static ChunkSummary summarizeChunk(const char* data, size_t len, bool startsInString){
+                ChunkSummary summary;
+                bool inString = startsInString;
+                size_t pos = 0;
+                while(pos < len){
+                    if(inString){
+                        pos += jsonsimd::findQuoteOrBackslash(data + pos, len - pos);
+                        if(pos >= len){
+                            break;
+                        }
+                        if(data[pos] == '\\'){
+                            pos += 2;
+                            continue;
+                        }
+                        inString = false;
+                        pos += 1;
+                        continue;
+                    }
+                    switch(data[pos]){
+                        case '{':
+                        case '[':
+                            summary.levelDelta += 1;
+                            summary.lastBreak = lineState::NEWLINE;
+                            summary.closedAfterBreak = false;
+                            break;
+                        case ',':
+                            summary.lastBreak = lineState::NEWLINE;
+                            summary.closedAfterBreak = false;
+                            break;
+                        case '}':
+                        case ']':
+                            summary.levelDelta -= 1;
+                            summary.closedAfterBreak = true;
+                            break;
+                        case ':':
+                            summary.closedAfterBreak = true;
+                            break;
+                        case ' ':
+                        case '\n':
+                        case '\t':
+                            break;
+                        case '\"':
+                            inString = true;
+                            summary.lastBreak = lineState::NONE;
+                            break;
+                        default:
+                            summary.lastBreak = lineState::NONE;
+                            break;
+                    }
+                    pos += 1;
+                }
+                summary.endsInString = inString;
+                return summary;
+            }
+
+            static lineState applyBreak(const ChunkSummary& summary, lineState pending){
+                lineState result = summary.lastBreak == lineState::INDENT ? pending : summary.lastBreak;
+                if(result == lineState::NEWLINE && summary.closedAfterBreak){
+                    return lineState::INDENT;
+                }
+                return result;
+            }
+
+            // Chunk boundaries for the parallel modes. A boundary never directly
+            // follows a backslash, so no escape is ever split across chunks.
+            static std::vector<size_t> splitChunks(std::string_view input){
+                std::vector<size_t> bounds = {0};
+                size_t pos = 0;
+                while(input.size() - pos > PARALLEL_CHUNK_SIZE){
+                    pos += PARALLEL_CHUNK_SIZE;
+                    while(pos < input.size() && input[pos - 1] == '\\'){
+                        pos += 1;
+                    }
+                    bounds.push_back(pos);
+                }
+                if(bounds.back() != input.size()){
+                    bounds.push_back(input.size());
+                }
+                return bounds;
+            }
+
+            static unsigned resolveThreads(unsigned threads){
+                if(threads == 0){
+                    threads = std::thread::hardware_concurrency();
+                }
+                return threads == 0 ? 1 : threads;
+            }
+
+            // Runs task(0..count-1) on up to `threads` threads, each pulling the
+            // next index as it finishes the previous one.
+            template<typename Task>
+            static void parallelFor(size_t count, unsigned threads, Task task){
+                std::atomic<size_t> next(0);
+                auto worker = [&](){
+                    for(size_t i = next++; i < count; i = next++){
+                        task(i);
+                    }
+                };
+                std::vector<std::thread> pool;
+                for(unsigned t = 1; t < threads && t < count; t++){
+                    pool.emplace_back(worker);
+                }
+                worker();
+                for(auto& thread : pool){
+                    thread.join();
+                }
+            }
+
+            static size_t minifySpan(const char* data, size_t len, bool startsInString, char* out){
+                jsonsimd::Minifier minifier(startsInString);
+                size_t written = 0;
+                size_t pos = 0;
+                for(; len - pos >= jsonsimd::BLOCK_SIZE; pos += jsonsimd::BLOCK_SIZE){
+                    written += minifier.minifyBlock(data + pos, out + written);
+                }
+                if(pos < len){
+                    char block[jsonsimd::BLOCK_SIZE];
+                    std::memset(block, ' ', jsonsimd::BLOCK_SIZE);
+                    std::memcpy(block, data + pos, len - pos);
+                    written += minifier.minifyBlock(block, out + written, (uint64_t(1) << (len - pos)) - 1);
+                }
+                return written;
+            }
+
+            // Feeds the input to task one batch of JSON Lines records at a
+            // time. Each batch is cut into contiguous slices handled on
+            // `threads` threads, and the slices' output is written in input
+            // order before the next batch is read.
+            template<typename SliceTask>
+            void processLines(unsigned threads, SliceTask task){
+                threads = resolveThreads(threads);
+                size_t sliceCount = threads == 1 ? 1 : threads * 4;
+                std::vector<std::string> outputs(sliceCount);
+                fileutils::LineBatch batch;
+                while(batch.fill(inputJson, PARALLEL_CHUNK_SIZE)){
+                    const std::vector<std::string_view>& records = batch.records();
+                    size_t slices = std::min(sliceCount, records.size());
+                    parallelFor(slices, threads, [&](size_t i){
+                        size_t from = records.size() * i / slices;
+                        size_t to = records.size() * (i + 1) / slices;
+                        outputs[i].clear();
+                        task(records.data() + from, to - from, outputs[i]);
+                    });
+                    for(size_t i = 0; i < slices; i++){
+                        outPutJson.write(outputs[i]);
+                    }
+                }
+            }
+
         public:
             JsonFormat(std::string inputFile, std::string outPutFile) \
             : inputJson(inputFile),
@@ -19,176 +877,223 @@ namespace jsonfmt{
             }
 
             void formatJson(int indent = 4){
-                long level = 0;
-                char nextChar;
-                int isNewLine = 0;
-                int isEscapedChar = 0;
+                JSONSTATS_PHASE(FORMAT);
+                FormatState state;
+                IndentTable indentTable(indent);
                 while(true){
-                    nextChar = inputJson.readNextChar();
-                    if(inputJson.isEof()){
+                    std::string_view chunk = inputJson.currentChunk();
+                    if(chunk.empty()){
                         break;
                     }
-                    switch(cntx){
-                        case context::NORMAL:{
-                            switch(nextChar){
-                                case '{':
-                                    if(isNewLine){
-                                        isNewLine = 0;
-                                        for(int i = 0; i < level; i++){
-                                            for(int j = 0;j < indent; j++){
-                                                outPutJson.pushChar(' ');
-                                            }
-                                        }
-                                    }
-                                    outPutJson.pushChar('{');
-                                    outPutJson.pushChar('\n');
-                                    isNewLine = 1;
-                                    level += 1;
-                                    break;
-                                case '[':
-                                    if(isNewLine){
-                                        isNewLine = 0;
-                                        for(int i = 0; i < level; i++){
-                                            for(int j = 0;j < indent; j++){
-                                            outPutJson.pushChar(' ');
-                                            }
-                                        }
-                                    }
-                                    outPutJson.pushChar('[');
-                                    outPutJson.pushChar('\n');
-                                    isNewLine = 1;
-                                    level += 1;
-                                    break;
-                                case ':':
-                                    outPutJson.pushChar(':');
-                                    outPutJson.pushChar(' ');
-                                    break;
-                                case ' ':
-                                case '\n':
-                                case '\t':
-                                    break;
-                                case '}':
-                                    outPutJson.pushChar('\n');
-                                    level -= 1;
-                                    for(int i = 0;i < level;i++){
-                                        for(int j = 0;j < indent; j++){
-                                                outPutJson.pushChar(' ');
-                                                }
-                                    }
-                                    outPutJson.pushChar('}');
-                                    break;
-                                case ']':
-                                    outPutJson.pushChar('\n');
-                                    level -= 1;
-                                    for(int i = 0;i < level;i++){
-                                        for(int j = 0;j < indent; j++){
-                                            outPutJson.pushChar(' ');
-                                            }
-                                    }
-                                    outPutJson.pushChar(']');
-                                    break;
-                                case ',':
-                                    outPutJson.pushChar(',');
-                                    outPutJson.pushChar('\n');
-                                    isNewLine = 1;
-                                    break;
-                                case '\"':
-                                    cntx = context::STRING;
-                                default:
-                                    if(isNewLine){
-                                        isNewLine = 0;
-                                        for(int i = 0; i < level; i++){
-                                            for(int j = 0;j < indent; j++){
-                                                outPutJson.pushChar(' ');
-                                            }
-                                        }
-                                    }
-                                    outPutJson.pushChar(nextChar);
-                                    break;
-                                    
-                            }
-                            break;
+                    formatSpan(chunk.data(), chunk.size(), state, indentTable, outPutJson);
+                    inputJson.advance(chunk.size());
+                }
+                if(state.pending == lineState::NEWLINE){
+                    outPutJson.pushChar('\n');
+                }
+            }
+
+            // Same output as formatJson(indent), produced by formatting chunks of
+            // a memory-mapped input on `threads` threads (0 = one per core). A
+            // cheap first pass records each chunk's effect on string context,
+            // nesting depth and pending line break for both possible starting
+            // contexts, which fixes every chunk's starting state. Output is
+            // written in waves of one chunk per thread to bound memory. Falls
+            // back to formatJson for unmapped input (pipes).
+            void formatJsonParallel(int indent = 4, unsigned threads = 0){
+                JSONSTATS_PHASE(FORMAT);
+                threads = resolveThreads(threads);
+                std::string_view input = inputJson.fileView();
+                if(!inputJson.isMapped() || threads == 1 || input.size() <= PARALLEL_CHUNK_SIZE){
+                    formatJson(indent);
+                    return;
+                }
+                std::vector<size_t> bounds = splitChunks(input);
+                size_t chunkCount = bounds.size() - 1;
+                std::vector<ChunkSummary> summaries(chunkCount * 2);
+                parallelFor(chunkCount * 2, threads, [&](size_t i){
+                    size_t chunk = i / 2;
+                    summaries[i] = summarizeChunk(input.data() + bounds[chunk], bounds[chunk + 1] - bounds[chunk], i % 2 == 1);
+                });
+
+                std::vector<FormatState> starts(chunkCount + 1);
+                for(size_t chunk = 0; chunk < chunkCount; chunk++){
+                    const FormatState& start = starts[chunk];
+                    const ChunkSummary& summary = summaries[chunk * 2 + (start.cntx == context::STRING ? 1 : 0)];
+                    FormatState& end = starts[chunk + 1];
+                    end.cntx = summary.endsInString ? context::STRING : context::NORMAL;
+                    end.level = start.level + summary.levelDelta;
+                    end.pending = applyBreak(summary, start.pending);
+                }
+
+                std::vector<std::string> outputs(threads);
+                for(size_t wave = 0; wave < chunkCount; wave += threads){
+                    size_t waveSize = std::min<size_t>(threads, chunkCount - wave);
+                    parallelFor(waveSize, threads, [&](size_t i){
+                        size_t chunk = wave + i;
+                        FormatState state = starts[chunk];
+                        IndentTable indentTable(indent);
+                        outputs[i].clear();
+                        fileutils::BufferWriter writer(outputs[i]);
+                        formatSpan(input.data() + bounds[chunk], bounds[chunk + 1] - bounds[chunk], state, indentTable, writer);
+                    });
+                    for(size_t i = 0; i < waveSize; i++){
+                        outPutJson.write(outputs[i]);
+                    }
+                }
+                if(starts[chunkCount].pending == lineState::NEWLINE){
+                    outPutJson.pushChar('\n');
+                }
+            }
+
+            // Same output as minifyJson(), minifying chunks of a memory-mapped
+            // input on `threads` threads. Only the string context at each chunk
+            // boundary is needed; the first pass gets it from the same block
+            // classifier the minifier uses.
+            void minifyJsonParallel(unsigned threads = 0){
+                JSONSTATS_PHASE(FORMAT);
+                threads = resolveThreads(threads);
+                std::string_view input = inputJson.fileView();
+                if(!inputJson.isMapped() || threads == 1 || input.size() <= PARALLEL_CHUNK_SIZE){
+                    minifyJson();
+                    return;
+                }
+                std::vector<size_t> bounds = splitChunks(input);
+                size_t chunkCount = bounds.size() - 1;
+                std::vector<char> endsInString(chunkCount * 2);
+                parallelFor(chunkCount * 2, threads, [&](size_t i){
+                    size_t chunk = i / 2;
+                    endsInString[i] = jsonsimd::endsInString(input.data() + bounds[chunk], bounds[chunk + 1] - bounds[chunk], i % 2 == 1);
+                });
+
+                std::vector<char> startsInString(chunkCount, 0);
+                for(size_t chunk = 1; chunk < chunkCount; chunk++){
+                    startsInString[chunk] = endsInString[(chunk - 1) * 2 + startsInString[chunk - 1]];
+                }
+
+                std::vector<std::vector<char>> outputs(threads);
+                std::vector<size_t> written(threads);
+                for(size_t wave = 0; wave < chunkCount; wave += threads){
+                    size_t waveSize = std::min<size_t>(threads, chunkCount - wave);
+                    parallelFor(waveSize, threads, [&](size_t i){
+                        size_t chunk = wave + i;
+                        size_t len = bounds[chunk + 1] - bounds[chunk];
+                        outputs[i].resize(len + jsonsimd::BLOCK_SIZE + 8);
+                        written[i] = minifySpan(input.data() + bounds[chunk], len, startsInString[chunk] != 0, outputs[i].data());
+                    });
+                    for(size_t i = 0; i < waveSize; i++){
+                        outPutJson.write(outputs[i].data(), written[i]);
+                    }
+                }
+            }
+
+            // JSON Lines input: every non-blank line is a document of its own,
+            // formatted as by formatJson(indent) and followed by one '\n'.
+            // Blank lines are dropped. Memory stays bounded by the batch size
+            // whatever the input size, and works for pipes as well.
+            void formatJsonLines(int indent = 4, unsigned threads = 0){
+                JSONSTATS_PHASE(FORMAT);
+                processLines(threads, [indent](const std::string_view* records, size_t count, std::string& out){
+                    IndentTable indentTable(indent);
+                    fileutils::BufferWriter writer(out);
+                    for(size_t i = 0; i < count; i++){
+                        if(fileutils::LineBatch::isBlank(records[i])){
+                            continue;
                         }
-                        case context::STRING:{
-                            switch(nextChar){
-                                case '\\':
-                                    isEscapedChar = 1;
-                                    outPutJson.pushChar(nextChar);
-                                    break;
-                                case '\"':
-                                    outPutJson.pushChar('\"');
-                                    if(isEscapedChar == 0){
-                                        cntx = context::NORMAL;
-                                    }
-                                    else{
-                                        isEscapedChar = 0;
-                                    }
-                                    break;
-                                default:
-                                    if(isEscapedChar){
-                                        isEscapedChar = 0;
-                                    }
-                                    outPutJson.pushChar(nextChar);
-                                    break;
-                                
-                            }
-                            break;
+                        FormatState state;
+                        formatSpan(records[i].data(), records[i].size(), state, indentTable, writer);
+                        writer.pushChar('\n');
+                    }
+                });
+            }
 
+            // JSON Lines input: every non-blank line minified to one output
+            // line, in input order.
+            void minifyJsonLines(unsigned threads = 0){
+                JSONSTATS_PHASE(FORMAT);
+                processLines(threads, [](const std::string_view* records, size_t count, std::string& out){
+                    for(size_t i = 0; i < count; i++){
+                        if(fileutils::LineBatch::isBlank(records[i])){
+                            continue;
                         }
+                        size_t at = out.size();
+                        out.resize(at + records[i].size() + jsonsimd::BLOCK_SIZE + 8);
+                        at += minifySpan(records[i].data(), records[i].size(), false, &out[at]);
+                        out.resize(at);
+                        out.push_back('\n');
                     }
+                });
+            }
+
+            // Writes only the subtrees selected by JSON Pointer paths (see
+            // PathProjector), minified, with the objects and arrays leading to
+            // them. The root is always written, empty if nothing matched.
+            void projectJson(const std::vector<std::string>& pointers){
+                JSONSTATS_PHASE(FORMAT);
+                PointerSet paths(pointers);
+                PathProjector<fileutils::OutputFileWriter> projector(paths, outPutJson);
+                while(!projector.done()){
+                    std::string_view chunk = inputJson.currentChunk();
+                    if(chunk.empty()){
+                        break;
+                    }
+                    projector.feed(chunk.data(), chunk.size());
+                    inputJson.advance(chunk.size());
                 }
+                projector.finish();
             }
 
+            // Strips whitespace outside strings 64 bytes at a time (see
+            // jsonsimd::Minifier). Input is regrouped into whole blocks across
+            // reader chunks so the string state carries over exactly.
             void minifyJson(){
-                int isEscapedChar = 0;
+                JSONSTATS_PHASE(FORMAT);
+                const size_t STAGING_SIZE = 1 << 16;
+                jsonsimd::Minifier minifier;
+                std::vector<char> staging(STAGING_SIZE + jsonsimd::BLOCK_SIZE + 8);
+                size_t staged = 0;
+                auto minifyBlock = [&](const char* blockData, uint64_t validMask){
+                    staged += minifier.minifyBlock(blockData, staging.data() + staged, validMask);
+                    if(staged >= STAGING_SIZE){
+                        outPutJson.write(staging.data(), staged);
+                        staged = 0;
+                    }
+                };
+                char block[jsonsimd::BLOCK_SIZE];
+                size_t blockFill = 0;
                 while(true){
-                    char nextChar = inputJson.readNextChar();
-                    if(inputJson.isEof()){
+                    std::string_view chunk = inputJson.currentChunk();
+                    if(chunk.empty()){
                         break;
                     }
-                    switch(cntx){
-                        case context::NORMAL: {
-                            switch(nextChar){
-                                case '\n':
-                                case '\t':
-                                case ' ' :
-                                    break;
-                                case '\"':
-                                    cntx = context::STRING;
-                                default:
-                                    outPutJson.pushChar(nextChar);
-                                    break;
-                            }
-                            break;
-                        }
-                        case context::STRING: {
-                            switch(nextChar){
-                                case '\\':
-                                    isEscapedChar = 1;
-                                    outPutJson.pushChar(nextChar);
-                                    break;
-                                case '\"':
-                                    outPutJson.pushChar('\"');
-                                    if(isEscapedChar == 0){
-                                        cntx = context::NORMAL;
-                                    }
-                                    else{
-                                        isEscapedChar = 0;
-                                    }
-                                    break;
-                                default:
-                                    if(isEscapedChar){
-                                        isEscapedChar = 0;
-                                    }
-                                    outPutJson.pushChar(nextChar);
-                                    break;
-                                
-                            }
-                            break;
+                    const char* data = chunk.data();
+                    size_t len = chunk.size();
+                    size_t pos = 0;
+                    if(blockFill > 0){
+                        size_t take = std::min(jsonsimd::BLOCK_SIZE - blockFill, len);
+                        std::memcpy(block + blockFill, data, take);
+                        blockFill += take;
+                        pos += take;
+                        if(blockFill == jsonsimd::BLOCK_SIZE){
+                            minifyBlock(block, ~uint64_t(0));
+                            blockFill = 0;
                         }
-
                     }
+                    while(len - pos >= jsonsimd::BLOCK_SIZE){
+                        minifyBlock(data + pos, ~uint64_t(0));
+                        pos += jsonsimd::BLOCK_SIZE;
+                    }
+                    if(pos < len){
+                        std::memcpy(block + blockFill, data + pos, len - pos);
+                        blockFill += len - pos;
+                    }
+                    inputJson.advance(len);
+                }
+                if(blockFill > 0){
+                    std::memset(block + blockFill, ' ', jsonsimd::BLOCK_SIZE - blockFill);
+                    minifyBlock(block, (uint64_t(1) << blockFill) - 1);
                 }
+                outPutJson.write(staging.data(), staged);
             }
     };
-};
+};
\ No newline at end of file
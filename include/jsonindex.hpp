@@ -0,0 +1,251 @@
+#pragma once
+#include "jsonsimd.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace jsonindex{
+
+    // Offsets of every { } [ ] : , outside strings, found a 64-byte block at
+    // a time, with the brackets paired up. Every entry carries one link:
+    //   opener      -> its closer
+    //   closer      -> its opener
+    //   ',' and ':' -> the opener of the container they separate
+    // so skipping a container is one lookup and walking up out of a nested
+    // value costs one lookup per level. Each container's ',' entries are
+    // also grouped together, so its n-th member or element is found without
+    // walking the ones before it. Eight bytes per entry, plus four per ','
+    // and eight per container; the input must be under 4 GiB and must
+    // outlive the index.
+    class StructuralIndex{
+        public:
+            static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+            // The ',' entries of one container, in input order.
+            struct SeparatorRun{
+                const uint32_t* entries;
+                size_t count;
+            };
+
+        private:
+            std::string_view input;
+            std::vector<uint32_t> offsets;
+            std::vector<uint32_t> links;
+            std::vector<uint32_t> containers; // opener entries, ascending
+            std::vector<uint32_t> firstSeparator; // per container, into separators; one extra
+            std::vector<uint32_t> separators;
+
+            [[noreturn]] static void throwError(const std::string& what, size_t offset){
+                throw std::runtime_error("Structural index: " + what + " at byte " + std::to_string(offset));
+            }
+
+            void addBlock(const char* block, size_t base, uint64_t structural, std::vector<uint32_t>& open){
+                while(structural != 0){
+                    size_t offset = base + __builtin_ctzll(structural);
+                    structural &= structural - 1;
+                    uint32_t entry = static_cast<uint32_t>(offsets.size());
+                    char ch = block[offset - base];
+                    offsets.push_back(static_cast<uint32_t>(offset));
+                    if(ch == '{' || ch == '['){
+                        links.push_back(NONE);
+                        open.push_back(entry);
+                    }
+                    else if(ch == '}' || ch == ']'){
+                        if(open.empty()){
+                            throwError(std::string("unmatched '") + ch + "'", offset);
+                        }
+                        uint32_t opener = open.back();
+                        // '{' + 2 == '}' and '[' + 2 == ']'.
+                        if(input[offsets[opener]] + 2 != ch){
+                            throwError(std::string("'") + ch + "' does not close '" + input[offsets[opener]] + "'", offset);
+                        }
+                        open.pop_back();
+                        links[opener] = entry;
+                        links.push_back(opener);
+                    }
+                    else{
+                        links.push_back(open.empty() ? NONE : open.back());
+                    }
+                }
+            }
+
+            // Counting sort of the ',' entries by container.
+            void groupSeparators(){
+                containers.clear();
+                std::vector<uint32_t> ordinal(offsets.size());
+                for(size_t entry = 0; entry < offsets.size(); entry++){
+                    if(isOpener(entry)){
+                        ordinal[entry] = static_cast<uint32_t>(containers.size());
+                        containers.push_back(static_cast<uint32_t>(entry));
+                    }
+                }
+                firstSeparator.assign(containers.size() + 1, 0);
+                for(size_t entry = 0; entry < offsets.size(); entry++){
+                    if(character(entry) == ',' && links[entry] != NONE){
+                        firstSeparator[ordinal[links[entry]] + 1]++;
+                    }
+                }
+                for(size_t i = 1; i < firstSeparator.size(); i++){
+                    firstSeparator[i] += firstSeparator[i - 1];
+                }
+                separators.resize(firstSeparator.back());
+                std::vector<uint32_t> next(firstSeparator.begin(), firstSeparator.end() - 1);
+                for(size_t entry = 0; entry < offsets.size(); entry++){
+                    if(character(entry) == ',' && links[entry] != NONE){
+                        separators[next[ordinal[links[entry]]]++] = static_cast<uint32_t>(entry);
+                    }
+                }
+            }
+
+        public:
+            StructuralIndex() = default;
+
+            explicit StructuralIndex(std::string_view text){
+                build(text);
+            }
+
+            void build(std::string_view text){
+                if(text.size() >= NONE){
+                    throw std::runtime_error("Structural index: input is 4 GiB or larger");
+                }
+                input = text;
+                offsets.clear();
+                links.clear();
+                // Typical documents have a structural character every 6-10 bytes.
+                offsets.reserve(text.size() / 8);
+                links.reserve(text.size() / 8);
+                std::vector<uint32_t> open;
+                jsonsimd::StringTracker tracker;
+                jsonsimd::SimdLevel level = jsonsimd::simdLevel();
+                size_t pos = 0;
+                for(; text.size() - pos >= jsonsimd::BLOCK_SIZE; pos += jsonsimd::BLOCK_SIZE){
+                    jsonsimd::StructuralMasks masks = jsonsimd::classifyStructural(text.data() + pos, level);
+                    uint64_t inString = tracker.next(masks.quote, masks.backslash);
+                    addBlock(text.data() + pos, pos, masks.structural & ~inString, open);
+                }
+                if(pos < text.size()){
+                    char block[jsonsimd::BLOCK_SIZE];
+                    std::memset(block, ' ', jsonsimd::BLOCK_SIZE);
+                    std::memcpy(block, text.data() + pos, text.size() - pos);
+                    jsonsimd::StructuralMasks masks = jsonsimd::classifyStructural(block, level);
+                    uint64_t inString = tracker.next(masks.quote, masks.backslash);
+                    addBlock(block, pos, masks.structural & ~inString, open);
+                }
+                if(tracker.inString()){
+                    throwError("unterminated string", text.size());
+                }
+                if(!open.empty()){
+                    throwError(std::string("unclosed '") + input[offsets[open.back()]] + "'", offsets[open.back()]);
+                }
+                groupSeparators();
+            }
+
+            std::string_view text() const{
+                return input;
+            }
+
+            size_t size() const{
+                return offsets.size();
+            }
+
+            size_t offset(size_t entry) const{
+                return offsets[entry];
+            }
+
+            char character(size_t entry) const{
+                return input[offsets[entry]];
+            }
+
+            bool isOpener(size_t entry) const{
+                char ch = character(entry);
+                return ch == '{' || ch == '[';
+            }
+
+            bool isCloser(size_t entry) const{
+                char ch = character(entry);
+                return ch == '}' || ch == ']';
+            }
+
+            // The other bracket of an opener or closer.
+            size_t matching(size_t entry) const{
+                return links[entry];
+            }
+
+            // The opener of the container a ',' or ':' belongs to; NONE at the
+            // top level.
+            size_t container(size_t entry) const{
+                return links[entry];
+            }
+
+            // First entry at or after a byte offset (size() if none), by
+            // binary search.
+            size_t find(size_t byteOffset) const{
+                return static_cast<size_t>(std::lower_bound(offsets.begin(), offsets.end(), byteOffset) - offsets.begin());
+            }
+
+            // The closer of the innermost container still open just after
+            // entry: that of entry itself for an opener, of the enclosing
+            // container otherwise. Throws at the top level.
+            size_t enclosingCloser(size_t entry) const{
+                while(true){
+                    if(isOpener(entry)){
+                        return links[entry];
+                    }
+                    if(isCloser(entry)){
+                        // Whatever follows a closer is a separator or closer
+                        // of the enclosing container.
+                        if(++entry == offsets.size()){
+                            throwError("no enclosing container", input.size());
+                        }
+                        if(isCloser(entry)){
+                            return entry;
+                        }
+                        continue;
+                    }
+                    if(links[entry] == NONE){
+                        throwError("no enclosing container", offsets[entry]);
+                    }
+                    return links[links[entry]];
+                }
+            }
+
+            // The separators of the container opened at `opener`, by binary
+            // search over the containers.
+            SeparatorRun separatorsOf(size_t opener) const{
+                size_t i = static_cast<size_t>(std::lower_bound(containers.begin(), containers.end(), opener) - containers.begin());
+                return SeparatorRun{separators.data() + firstSeparator[i], firstSeparator[i + 1] - firstSeparator[i]};
+            }
+
+            // The first ',' belonging to the container opened at `opener` at
+            // or after entry, or the container's closer if there is none.
+            // Nested containers are stepped over whole and nested separators
+            // are left through their container's link, so the cost grows
+            // with the depth below `opener`, not with the bytes skipped.
+            size_t nextSeparator(size_t entry, size_t opener) const{
+                size_t closer = links[opener];
+                while(entry < closer){
+                    if(isOpener(entry)){
+                        entry = links[entry] + 1;
+                    }
+                    else if(isCloser(entry)){
+                        entry++;
+                    }
+                    else if(links[entry] == opener){
+                        if(character(entry) == ','){
+                            return entry;
+                        }
+                        entry++;
+                    }
+                    else{
+                        entry = links[links[entry]] + 1;
+                    }
+                }
+                return closer;
+            }
+    };
+}
@@ -1,7 +1,14 @@
 #pragma once
+#include "jsonstats.hpp"
 #include "jsontok.hpp"
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace jsonparse {
@@ -11,6 +18,8 @@ namespace jsonparse {
         ARRAY,
         LITERAL
     };
+    static_assert(static_cast<size_t>(JsonObjectType::LITERAL) + 1 == jsonstats::OBJECT_TYPE_SLOTS,
+                  "jsonstats node slots");
 
     enum class LiteralType {
         STRING,
@@ -27,30 +36,153 @@ namespace jsonparse {
 
     using JPtr = std::shared_ptr<JsonEntity>;
 
+    // Thrown by a parse that would need more memory than its budget allows.
+    class MemoryBudgetExceeded : public std::runtime_error {
+    private:
+        size_t budgetBytes;
+        size_t usedBytes;
+
+    public:
+        MemoryBudgetExceeded(size_t budget, size_t used)
+            : std::runtime_error("Memory budget of " + std::to_string(budget) + " bytes exceeded (" +
+                                 std::to_string(used) + " bytes needed)"),
+              budgetBytes(budget), usedBytes(used) {}
+
+        size_t budget() const { return budgetBytes; }
+        size_t used() const { return usedBytes; }
+    };
+
+    // Running total of the bytes a parse has allocated for its result,
+    // checked against a limit (0 = unlimited) on every charge. Charges may
+    // come from several threads, so parses running in parallel can share
+    // one budget.
+    class MemoryBudget {
+    private:
+        size_t limit;
+        std::atomic<size_t> usedBytes{0};
+
+    public:
+        explicit MemoryBudget(size_t budget = 0) : limit(budget) {}
+
+        void charge(size_t bytes) {
+            size_t used = usedBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+            if (limit != 0 && used > limit)
+                throw MemoryBudgetExceeded(limit, used);
+        }
+
+        size_t used() const { return usedBytes.load(std::memory_order_relaxed); }
+        size_t budget() const { return limit; }
+    };
+
+    // Header make_shared puts in front of each node (vtable pointer and the
+    // two reference counts).
+    static const size_t SHARED_NODE_OVERHEAD = sizeof(void*) + 2 * sizeof(int);
+
+    // Bytes a string holds on the heap; 0 while it fits the inline buffer.
+    inline size_t stringHeapBytes(const std::string& text) {
+        static const size_t inlineCapacity = std::string().capacity();
+        return text.capacity() > inlineCapacity ? text.capacity() + 1 : 0;
+    }
+
+    // FNV-1a over the key bytes. Deterministic, so key tables built with it
+    // do not depend on the standard library's std::hash.
+    inline uint64_t hashKey(std::string_view key) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (char ch : key) {
+            hash ^= static_cast<unsigned char>(ch);
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    // Smallest power of two with at least twice as many slots as keys.
+    inline size_t keyTableSize(size_t keys) {
+        size_t size = 1;
+        while (size < keys * 2)
+            size <<= 1;
+        return size;
+    }
+
     class JsonObject : public JsonEntity {
+    public:
+        // Objects with at least this many keys get a hash index.
+        static const size_t INDEX_THRESHOLD = 16;
+
     private:
         std::vector<std::pair<std::string, JPtr>> keyPairs;
+        // Open-addressing table of keyPairs positions + 1 (0 = empty slot).
+        // Maintained as keys are added, so lookups never write and a
+        // finished object can be read from many threads.
+        std::vector<uint32_t> keyIndex;
+
+        void indexKey(size_t position) {
+            size_t mask = keyIndex.size() - 1;
+            std::string_view key = keyPairs[position].first;
+            for (size_t slot = hashKey(key) & mask;; slot = (slot + 1) & mask) {
+                uint32_t entry = keyIndex[slot];
+                if (entry == 0) {
+                    keyIndex[slot] = static_cast<uint32_t>(position + 1);
+                    return;
+                }
+                if (keyPairs[entry - 1].first == key)
+                    return; // duplicate key: the first one wins, as in a scan
+            }
+        }
 
     public:
         JsonObjectType getObjType() const override {
             return JsonObjectType::OBJECT;
         }
 
-        void addKeyPair(const std::string& key, JPtr value) {
-            keyPairs.emplace_back(key, value);
+        void addKeyPair(std::string key, JPtr value) {
+            keyPairs.emplace_back(std::move(key), std::move(value));
+            size_t count = keyPairs.size();
+            if (count < INDEX_THRESHOLD)
+                return;
+            if (keyIndex.size() < count * 2) {
+                keyIndex.assign(keyTableSize(count * 2), 0);
+                for (size_t i = 0; i < count; i++)
+                    indexKey(i);
+            }
+            else {
+                indexKey(count - 1);
+            }
         }
 
-        JPtr getValue(const std::string& key) {
-            for (auto& kv : keyPairs) {
-                if (kv.first == key)
-                    return kv.second;
+        // Value of the first pair with this key, or nullptr.
+        const JPtr* findValue(std::string_view key) const {
+            if (keyIndex.empty()) {
+                for (auto& kv : keyPairs) {
+                    if (kv.first == key)
+                        return &kv.second;
+                }
+                return nullptr;
+            }
+            size_t mask = keyIndex.size() - 1;
+            for (size_t slot = hashKey(key) & mask;; slot = (slot + 1) & mask) {
+                uint32_t entry = keyIndex[slot];
+                if (entry == 0)
+                    return nullptr;
+                if (keyPairs[entry - 1].first == key)
+                    return &keyPairs[entry - 1].second;
             }
-            throw std::runtime_error("Key not found: " + key);
+        }
+
+        JPtr getValue(std::string_view key) const {
+            const JPtr* value = findValue(key);
+            if (value == nullptr)
+                throw std::runtime_error("Key not found: " + std::string(key));
+            return *value;
         }
 
         const std::vector<std::pair<std::string, JPtr>>& getKeyPairs() const {
             return keyPairs;
         }
+
+        // Heap bytes of the member and index tables, not counting the keys.
+        size_t heapBytes() const {
+            return keyPairs.capacity() * sizeof(keyPairs[0]) + keyIndex.capacity() * sizeof(uint32_t);
+        }
     };
 
     class JsonArray : public JsonEntity {
@@ -67,7 +199,11 @@ namespace jsonparse {
         }
 
         void addArrayVal(JPtr val) {
-            arrayVals.push_back(val);
+            arrayVals.push_back(std::move(val));
+        }
+
+        size_t heapBytes() const {
+            return arrayVals.capacity() * sizeof(JPtr);
         }
     };
 
@@ -84,19 +220,22 @@ namespace jsonparse {
         std::string value;
 
     public:
-        JsonString(const std::string& v) : value(v) {}
+        JsonString(std::string_view v) : value(v) {}
         LiteralType getLiteralType() const override { return LiteralType::STRING; }
         const std::string& getValue() const { return value; }
+        size_t heapBytes() const { return stringHeapBytes(value); }
     };
 
     class JsonNumber : public JsonLiteral {
     private:
-        float value;
+        jsontok::NumberValue value;
 
     public:
-        JsonNumber(float v) : value(v) {}
+        JsonNumber(jsontok::NumberValue v) : value(v) {}
+        JsonNumber(double v) : value(jsontok::NumberValue::fromDouble(v)) {}
         LiteralType getLiteralType() const override { return LiteralType::NUMBER; }
-        float getValue() const { return value; }
+        double getValue() const { return value.asDouble(); }
+        const jsontok::NumberValue& getNumberValue() const { return value; }
     };
 
     class JsonBool : public JsonLiteral {
@@ -114,6 +253,54 @@ namespace jsonparse {
         LiteralType getLiteralType() const override { return LiteralType::NULL_VAL; }
     };
 
+    // Bytes a parsed tree occupies: every node with its make_shared header,
+    // the member and element tables, keys and string values. Allocator
+    // bookkeeping is not included.
+    inline size_t treeMemoryUsage(const JPtr& root) {
+        size_t total = 0;
+        std::vector<const JsonEntity*> pending;
+        if (root)
+            pending.push_back(root.get());
+        while (!pending.empty()) {
+            const JsonEntity* node = pending.back();
+            pending.pop_back();
+            total += SHARED_NODE_OVERHEAD;
+            switch (node->getObjType()) {
+                case JsonObjectType::OBJECT: {
+                    auto obj = static_cast<const JsonObject*>(node);
+                    total += sizeof(JsonObject) + obj->heapBytes();
+                    for (const auto& kv : obj->getKeyPairs()) {
+                        total += stringHeapBytes(kv.first);
+                        pending.push_back(kv.second.get());
+                    }
+                    break;
+                }
+                case JsonObjectType::ARRAY: {
+                    auto arr = static_cast<const JsonArray*>(node);
+                    total += sizeof(JsonArray) + arr->heapBytes();
+                    for (const JPtr& value : arr->getArrayVals())
+                        pending.push_back(value.get());
+                    break;
+                }
+                default:
+                    switch (static_cast<const JsonLiteral*>(node)->getLiteralType()) {
+                        case LiteralType::STRING:
+                            total += sizeof(JsonString) + static_cast<const JsonString*>(node)->heapBytes();
+                            break;
+                        case LiteralType::NUMBER:
+                            total += sizeof(JsonNumber);
+                            break;
+                        case LiteralType::BOOL:
+                            total += sizeof(JsonBool);
+                            break;
+                        default:
+                            total += sizeof(JsonNull);
+                    }
+            }
+        }
+        return total;
+    }
+
     class JsonParser {
     private:
         static void throwError(const std::string& where,
@@ -124,31 +311,131 @@ namespace jsonparse {
                 "\n[JSON Parse Error]\n"
                 "Location: " + where + "\n"
                 "Expected: " + expected + "\n"
-                "Found Token: '" + found.getRawTokenValue() + "'\n"
+                "Found Token: '" + std::string(found.getRawTokenValue()) + "'\n"
                 "TokenType: " + std::to_string(static_cast<int>(found.getTokenType())) + "\n";
 
             throw std::runtime_error(msg);
         }
 
+        template <typename T, typename... Args>
+        static std::shared_ptr<T> makeNode(MemoryBudget* budget, Args&&... args) {
+            std::shared_ptr<T> node = std::make_shared<T>(std::forward<Args>(args)...);
+            JSONSTATS_ADD(allocations, 1);
+            JSONSTATS_COUNT_NODE(node->getObjType());
+            if (budget) {
+                size_t bytes = sizeof(T) + SHARED_NODE_OVERHEAD;
+                if constexpr (std::is_same<T, JsonString>::value)
+                    bytes += node->heapBytes();
+                budget->charge(bytes);
+            }
+            return node;
+        }
+
+        // The key is moved into the object; its storage and any growth of
+        // the member table are charged to the budget.
+        static void addMember(JsonObject& obj, std::string& key, JPtr value, MemoryBudget* budget) {
+            if (!budget) {
+                obj.addKeyPair(std::move(key), std::move(value));
+                return;
+            }
+            size_t before = obj.heapBytes();
+            size_t keyBytes = stringHeapBytes(key);
+            obj.addKeyPair(std::move(key), std::move(value));
+            budget->charge(obj.heapBytes() - before + keyBytes);
+        }
+
+        static void addElement(JsonArray& arr, JPtr value, MemoryBudget* budget) {
+            if (!budget) {
+                arr.addArrayVal(std::move(value));
+                return;
+            }
+            size_t before = arr.heapBytes();
+            arr.addArrayVal(std::move(value));
+            budget->charge(arr.heapBytes() - before);
+        }
+
     public:
 
-        static JPtr startParsing(jsontok::JsonOnDemandTokenizer& tokenizer) {
+        // With a budget, the tree's memory is tracked as it is built and
+        // MemoryBudgetExceeded is thrown as soon as it goes over.
+        static JPtr startParsing(jsontok::JsonOnDemandTokenizer& tokenizer, MemoryBudget* budget = nullptr) {
+            JSONSTATS_PHASE(BUILD);
             jsontok::Token peek = tokenizer.peekNextToken();
             jsontok::TokenType type = peek.getTokenType();
 
             if (type == jsontok::TokenType::OPEN_BRACE) {
-                return parseObject(tokenizer);
+                return parseObject(tokenizer, budget);
             }
             else if (type == jsontok::TokenType::OPEN_BRACK) {
-                return parseArray(tokenizer);
+                return parseArray(tokenizer, budget);
             }
             else {
                 throwError("startParsing()", "{ or [", peek);
             }
         } 
 
-        static JPtr parseObject(jsontok::JsonOnDemandTokenizer& tokenizer) {
-            JPtr jsonEntity = std::make_shared<JsonObject>();
+        // Any value, scalars included.
+        static JPtr parseValue(jsontok::JsonOnDemandTokenizer& tokenizer, MemoryBudget* budget = nullptr) {
+            jsontok::Token tok = tokenizer.peekNextToken();
+            JPtr value;
+            switch (tok.getTokenType()) {
+                case jsontok::TokenType::OPEN_BRACE:
+                    return parseObject(tokenizer, budget);
+                case jsontok::TokenType::OPEN_BRACK:
+                    return parseArray(tokenizer, budget);
+                case jsontok::TokenType::BOOL:
+                    value = makeNode<JsonBool>(budget, tok.getRawTokenValue() == "true");
+                    break;
+                case jsontok::TokenType::STRING:
+                    value = makeNode<JsonString>(budget, tok.getRawTokenValue());
+                    break;
+                case jsontok::TokenType::NUMBER:
+                    value = makeNode<JsonNumber>(budget, tok.getNumberValue());
+                    break;
+                case jsontok::TokenType::NULL_VAL:
+                    value = makeNode<JsonNull>(budget);
+                    break;
+                default:
+                    throwError("parseValue()", "literal | array | object", tok);
+            }
+            tokenizer.getNextToken();
+            return value;
+        }
+
+        // Parses a run of members ("key": value, ...) when keys is given,
+        // or of elements (value, ...) otherwise, up to the end of the
+        // tokenizer's input: the inside of a container, or a piece of it cut
+        // at a separating comma. An empty run is accepted only if allowEmpty.
+        // The values and the keys' storage are charged to the budget; the
+        // container they end up in is the caller's to charge.
+        static void parseRun(jsontok::JsonOnDemandTokenizer& tokenizer, std::vector<std::string>* keys,
+                             std::vector<JPtr>& values, bool allowEmpty, MemoryBudget* budget = nullptr) {
+            JSONSTATS_PHASE(BUILD);
+            if (allowEmpty && tokenizer.peekNextToken().getTokenType() == jsontok::TokenType::END_OF_FILE)
+                return;
+            while (true) {
+                if (keys) {
+                    jsontok::Token tok = tokenizer.getNextToken();
+                    if (tok.getTokenType() != jsontok::TokenType::STRING)
+                        throwError("parseRun(): reading key", "STRING (object key)", tok);
+                    keys->emplace_back(tok.getRawTokenValue());
+                    if (budget)
+                        budget->charge(stringHeapBytes(keys->back()));
+                    tok = tokenizer.getNextToken();
+                    if (tok.getTokenType() != jsontok::TokenType::COLON)
+                        throwError("parseRun(): after key", "COLON ':'", tok);
+                }
+                values.push_back(parseValue(tokenizer, budget));
+                jsontok::Token tok = tokenizer.getNextToken();
+                if (tok.getTokenType() == jsontok::TokenType::END_OF_FILE)
+                    return;
+                if (tok.getTokenType() != jsontok::TokenType::COMMA)
+                    throwError("parseRun(): expecting comma", "','", tok);
+            }
+        }
+
+        static JPtr parseObject(jsontok::JsonOnDemandTokenizer& tokenizer, MemoryBudget* budget = nullptr) {
+            JPtr jsonEntity = makeNode<JsonObject>(budget);
             auto obj = std::static_pointer_cast<JsonObject>(jsonEntity);
 
             jsontok::Token currentTok = tokenizer.getNextToken(); // consumes '{'
@@ -165,7 +452,8 @@ namespace jsonparse {
                     throwError("parseObject(): reading key", "STRING (object key)", currentTok);
                 }
 
-                currKey = currentTok.getRawTokenValue();
+                // Copied now: the token's view does not survive the next token.
+                currKey.assign(currentTok.getRawTokenValue());
 
                 currentTok = tokenizer.getNextToken();
                 if (currentTok.getTokenType() != jsontok::TokenType::COLON) {
@@ -178,38 +466,38 @@ namespace jsonparse {
 
                     case jsontok::TokenType::BOOL: {
                         bool val = (currentTok.getRawTokenValue() == "true");
-                        obj->addKeyPair(currKey, std::make_shared<JsonBool>(val));
+                        addMember(*obj, currKey, makeNode<JsonBool>(budget, val), budget);
                         tokenizer.getNextToken();
                         break;
                     }
 
                     case jsontok::TokenType::STRING: {
-                        obj->addKeyPair(currKey,
-                            std::make_shared<JsonString>(currentTok.getRawTokenValue()));
+                        addMember(*obj, currKey,
+                            makeNode<JsonString>(budget, currentTok.getRawTokenValue()), budget);
                         tokenizer.getNextToken();
                         break;
                     }
 
                     case jsontok::TokenType::NUMBER: {
-                        obj->addKeyPair(currKey,
-                            std::make_shared<JsonNumber>(std::stod(currentTok.getRawTokenValue())));
+                        addMember(*obj, currKey,
+                            makeNode<JsonNumber>(budget, currentTok.getNumberValue()), budget);
                         tokenizer.getNextToken();
                         break;
                     }
 
                     case jsontok::TokenType::NULL_VAL: {
-                        obj->addKeyPair(currKey, std::make_shared<JsonNull>());
+                        addMember(*obj, currKey, makeNode<JsonNull>(budget), budget);
                         tokenizer.getNextToken();
                         break;
                     }
 
                     case jsontok::TokenType::OPEN_BRACK: {
-                        obj->addKeyPair(currKey, parseArray(tokenizer));
+                        addMember(*obj, currKey, parseArray(tokenizer, budget), budget);
                         break;
                     }
 
                     case jsontok::TokenType::OPEN_BRACE: {
-                        obj->addKeyPair(currKey, parseObject(tokenizer));
+                        addMember(*obj, currKey, parseObject(tokenizer, budget), budget);
                         break;
                     }
 
@@ -231,8 +519,8 @@ namespace jsonparse {
             return obj;
         }
 
-        static JPtr parseArray(jsontok::JsonOnDemandTokenizer& tokenizer) {
-            JPtr jsonEntity = std::make_shared<JsonArray>();
+        static JPtr parseArray(jsontok::JsonOnDemandTokenizer& tokenizer, MemoryBudget* budget = nullptr) {
+            JPtr jsonEntity = makeNode<JsonArray>(budget);
             auto arr = std::static_pointer_cast<JsonArray>(jsonEntity);
 
             jsontok::Token currentTok = tokenizer.getNextToken(); // consumes '['
@@ -244,42 +532,42 @@ namespace jsonparse {
                 switch (currentTok.getTokenType()) {
 
                     case jsontok::TokenType::BOOL: {
-                        arr->addArrayVal(std::make_shared<JsonBool>(
+                        addElement(*arr, makeNode<JsonBool>(budget,
                             currentTok.getRawTokenValue() == "true"
-                        ));
+                        ), budget);
                         tokenizer.getNextToken();
                         break;
                     }
 
                     case jsontok::TokenType::STRING: {
-                        arr->addArrayVal(std::make_shared<JsonString>(
+                        addElement(*arr, makeNode<JsonString>(budget,
                             currentTok.getRawTokenValue()
-                        ));
+                        ), budget);
                         tokenizer.getNextToken();
                         break;
                     }
 
                     case jsontok::TokenType::NUMBER: {
-                        arr->addArrayVal(std::make_shared<JsonNumber>(
-                            std::stod(currentTok.getRawTokenValue())
-                        ));
+                        addElement(*arr, makeNode<JsonNumber>(budget,
+                            currentTok.getNumberValue()
+                        ), budget);
                         tokenizer.getNextToken();
                         break;
                     }
 
                     case jsontok::TokenType::NULL_VAL: {
-                        arr->addArrayVal(std::make_shared<JsonNull>());
+                        addElement(*arr, makeNode<JsonNull>(budget), budget);
                         tokenizer.getNextToken();
                         break;
                     }
 
                     case jsontok::TokenType::OPEN_BRACE: {
-                        arr->addArrayVal(parseObject(tokenizer));
+                        addElement(*arr, parseObject(tokenizer, budget), budget);
                         break;
                     }
 
                     case jsontok::TokenType::OPEN_BRACK: {
-                        arr->addArrayVal(parseArray(tokenizer));
+                        addElement(*arr, parseArray(tokenizer, budget), budget);
                         break;
                     }
 
@@ -308,6 +596,18 @@ namespace jsonparse {
         }
     };
 
+    // Forward-only, on-demand access: doc["a"]["b"][3] reads the input only
+    // as far as that value and skips every sibling subtree on the way
+    // without building or allocating anything for it.
+    //
+    // Values must be visited in document order. A Value stays usable while
+    // it is the value at the read position or a container enclosing it;
+    // once reading has moved past it, using it throws. Keys are compared
+    // against the raw (still escaped) text, as JsonParser stores them.
+    //
+    // With a structural index on the tokenizer (see
+    // JsonOnDemandTokenizer::useIndex()), skipped subtrees and the array
+    // elements before a requested index are jumped over instead of scanned.
     class JsonSwifty{
         private:
             static void throwError(const std::string& where,
@@ -318,19 +618,284 @@ namespace jsonparse {
                     "\n[JSON Parse Error]\n"
                     "Location: " + where + "\n"
                     "Expected: " + expected + "\n"
-                    "Found Token: '" + found.getRawTokenValue() + "'\n"
+                    "Found Token: '" + std::string(found.getRawTokenValue()) + "'\n"
                     "TokenType: " + std::to_string(static_cast<int>(found.getTokenType())) + "\n";
 
                 throw std::runtime_error(msg);
             }
 
-            JPtr root;
+            // Where the read position is inside the innermost open container.
+            enum class Position{
+                VALUE_START,    // before a value that has been handed out (or the root)
+                AFTER_VALUE,    // before ',' or the closing bracket
+                BEFORE_KEY,     // just after '{' or an object's ','
+                BEFORE_ELEMENT  // just after '['
+            };
+
+            struct Frame{
+                uint64_t id;
+                jsontok::TokenType opener;
+                size_t nextIndex; // arrays: index of the next element reached
+            };
+
+            jsontok::JsonOnDemandTokenizer* tokenizer = nullptr;
+            std::vector<Frame> open;
+            Position position = Position::VALUE_START;
+            uint64_t currentId = 0;
+            uint64_t nextId = 0;
+            uint64_t rootId = 0;
             bool init = false;
-        
+
+        public:
+            class Value{
+                private:
+                    JsonSwifty* owner;
+                    uint64_t id;
+                    size_t depth;
+
+                    friend class JsonSwifty;
+                    Value(JsonSwifty* o, uint64_t i, size_t d) : owner(o), id(i), depth(d) {}
+
+                public:
+                    Value operator[](std::string_view key) const { return owner->findKey(*this, key); }
+                    Value operator[](size_t index) const { return owner->findIndex(*this, index); }
+
+                    bool isObject() const { return owner->peekType(*this) == jsontok::TokenType::OPEN_BRACE; }
+                    bool isArray() const { return owner->peekType(*this) == jsontok::TokenType::OPEN_BRACK; }
+                    bool isString() const { return owner->peekType(*this) == jsontok::TokenType::STRING; }
+                    bool isNumber() const { return owner->peekType(*this) == jsontok::TokenType::NUMBER; }
+                    bool isBool() const { return owner->peekType(*this) == jsontok::TokenType::BOOL; }
+                    bool isNull() const { return owner->peekType(*this) == jsontok::TokenType::NULL_VAL; }
+
+                    // The scalar readers consume the value.
+                    std::string asString() const {
+                        return std::string(owner->readScalar(*this, jsontok::TokenType::STRING, "asString()").getRawTokenValue());
+                    }
+                    jsontok::NumberValue numberValue() const {
+                        return owner->readScalar(*this, jsontok::TokenType::NUMBER, "numberValue()").getNumberValue();
+                    }
+                    double asDouble() const { return numberValue().asDouble(); }
+                    int64_t asInt64() const { return numberValue().asInt64(); }
+                    uint64_t asUint64() const { return numberValue().asUint64(); }
+                    bool asBool() const {
+                        return owner->readScalar(*this, jsontok::TokenType::BOOL, "asBool()").getRawTokenValue() == "true";
+                    }
+
+                    // Consumes the value without looking at it.
+                    void skip() const { owner->skip(*this); }
+            };
+
+        private:
+            Value makeValue(size_t depth){
+                currentId = ++nextId;
+                position = Position::VALUE_START;
+                return Value(this, currentId, depth);
+            }
+
+            bool isCurrent(const Value& v) const{
+                return open.size() == v.depth && position == Position::VALUE_START && currentId == v.id;
+            }
+
+            bool isOpen(const Value& v) const{
+                return open.size() > v.depth && open[v.depth].id == v.id;
+            }
+
+            void requireInit() const{
+                if(!init){
+                    throw std::runtime_error("JsonSwifty: startParsing() has not been called");
+                }
+            }
+
+            [[noreturn]] static void throwGone(){
+                throw std::runtime_error("JsonSwifty: value is behind the read position (values must be read in document order)");
+            }
+
+            // Skips whatever is left of the containers nested inside depth
+            // `depth`, leaving the read position just after the last value
+            // read or skipped at that depth.
+            void unwindTo(size_t depth){
+                while(true){
+                    if(position == Position::VALUE_START){
+                        tokenizer->skipValue();
+                        position = Position::AFTER_VALUE;
+                    }
+                    if(open.size() == depth){
+                        return;
+                    }
+                    tokenizer->skipContainer();
+                    open.pop_back();
+                    position = Position::AFTER_VALUE;
+                }
+            }
+
+            // Makes v the innermost open container, opening it if it is the
+            // current value. `opener` is the token it has to start with.
+            void enter(const Value& v, jsontok::TokenType opener, const char* where){
+                requireInit();
+                if(isOpen(v)){
+                    if(open[v.depth].opener != opener){
+                        throw std::runtime_error(std::string(where) + ": value is not " +
+                            (opener == jsontok::TokenType::OPEN_BRACE ? "an object" : "an array"));
+                    }
+                    unwindTo(v.depth + 1);
+                    return;
+                }
+                if(!isCurrent(v)){
+                    throwGone();
+                }
+                jsontok::Token tok = tokenizer->peekNextToken();
+                if(tok.getTokenType() != opener){
+                    throwError(where, opener == jsontok::TokenType::OPEN_BRACE ? "{" : "[", tok);
+                }
+                tokenizer->getNextToken();
+                open.push_back(Frame{v.id, opener, 0});
+                position = opener == jsontok::TokenType::OPEN_BRACE ? Position::BEFORE_KEY : Position::BEFORE_ELEMENT;
+            }
+
+            // Reads the ',' or closer after a value. Returns false (with the
+            // container closed) at the closer.
+            bool nextMember(jsontok::TokenType closer, const char* where){
+                jsontok::Token tok = tokenizer->getNextToken();
+                if(tok.getTokenType() == closer){
+                    open.pop_back();
+                    position = Position::AFTER_VALUE;
+                    return false;
+                }
+                if(tok.getTokenType() != jsontok::TokenType::COMMA){
+                    throwError(where, closer == jsontok::TokenType::CLOSE_BRACE ? "',' or '}'" : "',' or ']'", tok);
+                }
+                return true;
+            }
+
+            Value findKey(const Value& v, std::string_view key){
+                enter(v, jsontok::TokenType::OPEN_BRACE, "JsonSwifty: object lookup");
+                while(true){
+                    if(position == Position::AFTER_VALUE &&
+                       !nextMember(jsontok::TokenType::CLOSE_BRACE, "JsonSwifty: object lookup")){
+                        break;
+                    }
+                    jsontok::Token tok = tokenizer->getNextToken();
+                    if(tok.getTokenType() == jsontok::TokenType::CLOSE_BRACE){
+                        open.pop_back();
+                        position = Position::AFTER_VALUE;
+                        break;
+                    }
+                    if(tok.getTokenType() != jsontok::TokenType::STRING){
+                        throwError("JsonSwifty: object lookup", "STRING (object key)", tok);
+                    }
+                    bool match = tok.getRawTokenValue() == key;
+                    tok = tokenizer->getNextToken();
+                    if(tok.getTokenType() != jsontok::TokenType::COLON){
+                        throwError("JsonSwifty: object lookup", "COLON ':'", tok);
+                    }
+                    if(match){
+                        return makeValue(v.depth + 1);
+                    }
+                    tokenizer->skipValue();
+                    position = Position::AFTER_VALUE;
+                }
+                throw std::runtime_error("Key not found: " + std::string(key));
+            }
+
+            Value findIndex(const Value& v, size_t index){
+                // Checked before enter(), which would skip the pending element.
+                if(isOpen(v) && index < open[v.depth].nextIndex){
+                    throwGone();
+                }
+                enter(v, jsontok::TokenType::OPEN_BRACK, "JsonSwifty: array lookup");
+                Frame& frame = open.back();
+                while(true){
+                    if(position == Position::AFTER_VALUE &&
+                       !nextMember(jsontok::TokenType::CLOSE_BRACK, "JsonSwifty: array lookup")){
+                        break;
+                    }
+                    if(frame.nextIndex < index && tokenizer->hasIndex()){
+                        // Lands on element `index`, or before the ']' when
+                        // there are fewer elements.
+                        frame.nextIndex += tokenizer->skipElements(index - frame.nextIndex);
+                    }
+                    if(tokenizer->peekNextToken().getTokenType() == jsontok::TokenType::CLOSE_BRACK){
+                        tokenizer->getNextToken();
+                        open.pop_back();
+                        position = Position::AFTER_VALUE;
+                        break;
+                    }
+                    if(frame.nextIndex++ == index){
+                        return makeValue(v.depth + 1);
+                    }
+                    tokenizer->skipValue();
+                    position = Position::AFTER_VALUE;
+                }
+                throw std::runtime_error("Index out of bounds");
+            }
+
+            jsontok::TokenType peekType(const Value& v){
+                requireInit();
+                if(isOpen(v)){
+                    return open[v.depth].opener;
+                }
+                if(!isCurrent(v)){
+                    throwGone();
+                }
+                return tokenizer->peekNextToken().getTokenType();
+            }
+
+            jsontok::Token readScalar(const Value& v, jsontok::TokenType type, const char* where){
+                requireInit();
+                if(!isCurrent(v)){
+                    throwGone();
+                }
+                jsontok::Token tok = tokenizer->peekNextToken();
+                if(tok.getTokenType() != type){
+                    throwError(std::string("JsonSwifty: ") + where, "a value of the requested type", tok);
+                }
+                tokenizer->getNextToken();
+                position = Position::AFTER_VALUE;
+                return tok;
+            }
+
+            void skip(const Value& v){
+                requireInit();
+                if(isOpen(v)){
+                    unwindTo(v.depth + 1);
+                    tokenizer->skipContainer();
+                    open.pop_back();
+                    position = Position::AFTER_VALUE;
+                    return;
+                }
+                if(!isCurrent(v)){
+                    throwGone();
+                }
+                tokenizer->skipValue();
+                position = Position::AFTER_VALUE;
+            }
+
         public:
             
+            // The tokenizer must outlive every Value handed out.
             void startParsing(jsontok::JsonOnDemandTokenizer& tokenizer){
-                
+                jsontok::Token peek = tokenizer.peekNextToken();
+                if(peek.getTokenType() != jsontok::TokenType::OPEN_BRACE &&
+                   peek.getTokenType() != jsontok::TokenType::OPEN_BRACK){
+                    throwError("JsonSwifty::startParsing()", "{ or [", peek);
+                }
+                this->tokenizer = &tokenizer;
+                open.clear();
+                init = true;
+                rootId = makeValue(0).id;
+            }
+
+            Value root(){
+                requireInit();
+                return Value(this, rootId, 0);
+            }
+
+            Value operator[](std::string_view key){
+                return root()[key];
+            }
+
+            Value operator[](size_t index){
+                return root()[index];
             }
 
     };
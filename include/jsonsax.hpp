@@ -0,0 +1,423 @@
+#pragma once
+#include "jsontok.hpp"
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace jsonsax {
+
+    // Event callbacks with empty defaults. Derive from it and define only
+    // the events you need; EventParser calls them through the derived type,
+    // so nothing is virtual and unused events compile away.
+    //
+    // Keys and strings arrive raw (escapes still encoded, see
+    // jsontok::unescapeString), as views valid only during the callback.
+    struct Visitor {
+        void onObjectStart() {}
+        void onObjectEnd() {}
+        void onArrayStart() {}
+        void onArrayEnd() {}
+        void onKey(std::string_view) {}
+        void onString(std::string_view) {}
+        void onNumber(const jsontok::NumberValue&) {}
+        void onBool(bool) {}
+        void onNull() {}
+        // A top-level value is complete.
+        void onDocumentEnd() {}
+    };
+
+    // Drives a visitor from the token stream with the same grammar as
+    // jsonparse::JsonParser, without building any tree. Nesting is tracked
+    // on an explicit stack, so deep documents do not recurse.
+    template <typename V>
+    class EventParser {
+    private:
+        static void throwError(const std::string& where,
+                               const std::string& expected,
+                               const jsontok::Token& found)
+        {
+            std::string msg =
+                "\n[JSON Parse Error]\n"
+                "Location: " + where + "\n"
+                "Expected: " + expected + "\n"
+                "Found Token: '" + std::string(found.getRawTokenValue()) + "'\n"
+                "TokenType: " + std::to_string(static_cast<int>(found.getTokenType())) + "\n";
+
+            throw std::runtime_error(msg);
+        }
+
+    public:
+        static void parse(jsontok::JsonOnDemandTokenizer& tokenizer, V& visitor) {
+            std::vector<bool> inObject;
+            bool afterValue = false;
+
+            jsontok::Token tok = tokenizer.getNextToken();
+            if (tok.getTokenType() == jsontok::TokenType::OPEN_BRACE) {
+                inObject.push_back(true);
+                visitor.onObjectStart();
+            }
+            else if (tok.getTokenType() == jsontok::TokenType::OPEN_BRACK) {
+                inObject.push_back(false);
+                visitor.onArrayStart();
+            }
+            else {
+                throwError("EventParser::parse()", "{ or [", tok);
+            }
+
+            while (!inObject.empty()) {
+                bool object = inObject.back();
+                jsontok::TokenType closer = object ? jsontok::TokenType::CLOSE_BRACE : jsontok::TokenType::CLOSE_BRACK;
+                tok = tokenizer.getNextToken();
+
+                if (tok.getTokenType() == closer) {
+                    inObject.pop_back();
+                    if (object)
+                        visitor.onObjectEnd();
+                    else
+                        visitor.onArrayEnd();
+                    afterValue = true;
+                    continue;
+                }
+                if (afterValue) {
+                    if (tok.getTokenType() != jsontok::TokenType::COMMA) {
+                        throwError(object ? "parseObject(): expecting comma between pairs"
+                                          : "parseArray(): expecting comma between values",
+                                   object ? "',' or '}'" : "',' or ']'", tok);
+                    }
+                    afterValue = false;
+                    continue;
+                }
+
+                if (object) {
+                    if (tok.getTokenType() != jsontok::TokenType::STRING)
+                        throwError("parseObject(): reading key", "STRING (object key)", tok);
+                    visitor.onKey(tok.getRawTokenValue());
+                    tok = tokenizer.getNextToken();
+                    if (tok.getTokenType() != jsontok::TokenType::COLON)
+                        throwError("parseObject(): after key", "COLON ':'", tok);
+                    tok = tokenizer.getNextToken();
+                }
+
+                switch (tok.getTokenType()) {
+                    case jsontok::TokenType::OPEN_BRACE:
+                        inObject.push_back(true);
+                        visitor.onObjectStart();
+                        continue;
+                    case jsontok::TokenType::OPEN_BRACK:
+                        inObject.push_back(false);
+                        visitor.onArrayStart();
+                        continue;
+                    case jsontok::TokenType::STRING:
+                        visitor.onString(tok.getRawTokenValue());
+                        break;
+                    case jsontok::TokenType::NUMBER:
+                        visitor.onNumber(tok.getNumberValue());
+                        break;
+                    case jsontok::TokenType::BOOL:
+                        visitor.onBool(tok.getRawTokenValue() == "true");
+                        break;
+                    case jsontok::TokenType::NULL_VAL:
+                        visitor.onNull();
+                        break;
+                    default:
+                        throwError(object ? "parseObject(): value" : "parseArray(): value",
+                                   "literal | array | object", tok);
+                }
+                afterValue = true;
+            }
+            visitor.onDocumentEnd();
+        }
+    };
+
+    // Push-driven counterpart of EventParser for input that arrives in
+    // pieces (sockets, pipes): feed() takes fragments of any size, split
+    // anywhere, and raises each event as soon as its token is complete.
+    // Between calls it keeps only the nesting stack and the unfinished
+    // token, so whole messages are never buffered. Top-level values may
+    // follow one another; onDocumentEnd() marks the end of each. The
+    // grammar is EventParser's; an error leaves the parser unusable until
+    // reset().
+    template <typename V>
+    class PushParser {
+    private:
+        // What the next token may be.
+        enum class Expect {
+            ROOT,             // '{' or '[' starting a document
+            VALUE,            // after ':'
+            ELEMENT_OR_CLOSE, // after '[' or an array's ','
+            KEY_OR_CLOSE,     // after '{' or an object's ','
+            COLON,
+            COMMA_OR_CLOSE
+        };
+        // A token split across fragments.
+        enum class Partial {
+            NONE,
+            STRING,
+            NUMBER,
+            LITERAL
+        };
+        static const size_t MAX_LITERAL = 5;
+
+        V& visitor;
+        std::vector<bool> inObject;
+        Expect expect = Expect::ROOT;
+        Partial partial = Partial::NONE;
+        std::string pending;
+        bool isEscape = false;
+        bool stringIsKey = false;
+        size_t offset = 0;
+
+        [[noreturn]] void fail(size_t pos, const std::string& what) {
+            throw std::runtime_error("JSON push parse error at byte " + std::to_string(offset + pos) + ": " + what);
+        }
+
+        void startValue(size_t pos, bool container) {
+            if (expect == Expect::VALUE || expect == Expect::ELEMENT_OR_CLOSE)
+                return;
+            if (expect == Expect::ROOT && container)
+                return;
+            fail(pos, expect == Expect::ROOT ? "expected { or [" : "unexpected value");
+        }
+
+        void endValue() {
+            if (inObject.empty()) {
+                visitor.onDocumentEnd();
+                expect = Expect::ROOT;
+            }
+            else {
+                expect = Expect::COMMA_OR_CLOSE;
+            }
+        }
+
+        void open(size_t pos, bool object) {
+            startValue(pos, true);
+            inObject.push_back(object);
+            if (object) {
+                visitor.onObjectStart();
+                expect = Expect::KEY_OR_CLOSE;
+            }
+            else {
+                visitor.onArrayStart();
+                expect = Expect::ELEMENT_OR_CLOSE;
+            }
+        }
+
+        void close(size_t pos, bool object) {
+            bool allowed = expect == Expect::COMMA_OR_CLOSE ||
+                           expect == (object ? Expect::KEY_OR_CLOSE : Expect::ELEMENT_OR_CLOSE);
+            if (!allowed || inObject.empty() || inObject.back() != object)
+                fail(pos, std::string("unexpected '") + (object ? '}' : ']') + "'");
+            inObject.pop_back();
+            if (object)
+                visitor.onObjectEnd();
+            else
+                visitor.onArrayEnd();
+            endValue();
+        }
+
+        void finishString(std::string_view raw) {
+            if (stringIsKey) {
+                visitor.onKey(raw);
+                expect = Expect::COLON;
+                return;
+            }
+            visitor.onString(raw);
+            endValue();
+        }
+
+        void finishNumber(size_t pos, std::string_view text) {
+            jsontok::NumberValue number;
+            if (!jsontok::NumberParser::parseNumber(text, number))
+                fail(pos, "invalid number '" + std::string(text) + "'");
+            visitor.onNumber(number);
+            endValue();
+        }
+
+        void finishLiteral(size_t pos, std::string_view text) {
+            if (text == "true")
+                visitor.onBool(true);
+            else if (text == "false")
+                visitor.onBool(false);
+            else if (text == "null")
+                visitor.onNull();
+            else
+                fail(pos, "invalid literal '" + std::string(text) + "'");
+            endValue();
+        }
+
+        static bool isLiteralChar(char ch) {
+            return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+        }
+
+        // Collects the run of a number or literal starting at pos. Returns
+        // the end of the run, or len if the fragment ended inside it (the
+        // text so far is then kept in pending).
+        template <typename IsPart>
+        size_t scanRun(const char* data, size_t pos, size_t len, IsPart isPart, std::string_view& text) {
+            size_t start = pos;
+            while (pos < len && isPart(data[pos]))
+                pos++;
+            if (pos == len) {
+                pending.append(data + start, pos - start);
+                return len;
+            }
+            if (pending.empty()) {
+                text = std::string_view(data + start, pos - start);
+            }
+            else {
+                pending.append(data + start, pos - start);
+                text = pending;
+            }
+            return pos;
+        }
+
+    public:
+        PushParser(V& target) : visitor(target) {}
+
+        void feed(const char* data, size_t len) {
+            size_t pos = 0;
+            while (pos < len) {
+                switch (partial) {
+                    case Partial::STRING: {
+                        std::string_view rest(data + pos, len - pos);
+                        size_t end = jsontok::findStringEnd(rest, isEscape);
+                        if (end == std::string_view::npos) {
+                            pending.append(rest.data(), rest.size());
+                            pos = len;
+                            break;
+                        }
+                        partial = Partial::NONE;
+                        if (pending.empty()) {
+                            finishString(rest.substr(0, end));
+                        }
+                        else {
+                            pending.append(rest.data(), end);
+                            finishString(pending);
+                            pending.clear();
+                        }
+                        pos += end + 1;
+                        break;
+                    }
+                    case Partial::NUMBER: {
+                        std::string_view text;
+                        size_t end = scanRun(data, pos, len, jsontok::isNumberChar, text);
+                        if (end < len) {
+                            partial = Partial::NONE;
+                            finishNumber(pos, text);
+                            pending.clear();
+                        }
+                        pos = end;
+                        break;
+                    }
+                    case Partial::LITERAL: {
+                        std::string_view text;
+                        size_t end = scanRun(data, pos, len, isLiteralChar, text);
+                        if (pending.size() > MAX_LITERAL)
+                            fail(pos, "invalid literal '" + pending + "'");
+                        if (end < len) {
+                            partial = Partial::NONE;
+                            finishLiteral(pos, text);
+                            pending.clear();
+                        }
+                        pos = end;
+                        break;
+                    }
+                    case Partial::NONE: {
+                        char ch = data[pos];
+                        switch (ch) {
+                            case ' ':
+                            case '\n':
+                            case '\r':
+                            case '\t':
+                                pos++;
+                                break;
+                            case '{':
+                                open(pos++, true);
+                                break;
+                            case '[':
+                                open(pos++, false);
+                                break;
+                            case '}':
+                                close(pos++, true);
+                                break;
+                            case ']':
+                                close(pos++, false);
+                                break;
+                            case ',':
+                                if (expect != Expect::COMMA_OR_CLOSE)
+                                    fail(pos, "unexpected ','");
+                                expect = inObject.back() ? Expect::KEY_OR_CLOSE : Expect::ELEMENT_OR_CLOSE;
+                                pos++;
+                                break;
+                            case ':':
+                                if (expect != Expect::COLON)
+                                    fail(pos, "unexpected ':'");
+                                expect = Expect::VALUE;
+                                pos++;
+                                break;
+                            case '\"':
+                                stringIsKey = expect == Expect::KEY_OR_CLOSE;
+                                if (!stringIsKey)
+                                    startValue(pos, false);
+                                partial = Partial::STRING;
+                                isEscape = false;
+                                pos++;
+                                break;
+                            default:
+                                // Left in place: the NUMBER/LITERAL branch collects it.
+                                if (ch == '-' || (ch >= '0' && ch <= '9')) {
+                                    startValue(pos, false);
+                                    partial = Partial::NUMBER;
+                                }
+                                else if (isLiteralChar(ch)) {
+                                    startValue(pos, false);
+                                    partial = Partial::LITERAL;
+                                }
+                                else {
+                                    fail(pos, std::string("invalid character '") + ch + "'");
+                                }
+                        }
+                        break;
+                    }
+                }
+            }
+            offset += len;
+        }
+
+        void feed(std::string_view text) {
+            feed(text.data(), text.size());
+        }
+
+        // Declares the end of input; throws if it fell inside a value.
+        void finish() {
+            if (partial != Partial::NONE || !inObject.empty())
+                fail(0, "unexpected end of input");
+        }
+
+        // Nesting depth of the value being read; 0 between documents.
+        size_t depth() const {
+            return inObject.size();
+        }
+
+        void reset() {
+            inObject.clear();
+            expect = Expect::ROOT;
+            partial = Partial::NONE;
+            pending.clear();
+            isEscape = false;
+            offset = 0;
+        }
+    };
+
+    template <typename V>
+    void parse(jsontok::JsonOnDemandTokenizer& tokenizer, V& visitor) {
+        EventParser<V>::parse(tokenizer, visitor);
+    }
+
+    template <typename V>
+    void parseFile(const std::string& fileName, V& visitor) {
+        jsontok::JsonOnDemandTokenizer tokenizer(fileName);
+        EventParser<V>::parse(tokenizer, visitor);
+    }
+}
@@ -0,0 +1,483 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define JSONSIMD_X86 1
+#endif
+
+namespace jsonsimd{
+    static const size_t BLOCK_SIZE = 64;
+
+    enum class SimdLevel{
+        SCALAR,
+        SSE42,
+        AVX2
+    };
+
+    inline SimdLevel detectSimdLevel(){
+#ifdef JSONSIMD_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")){
+            return SimdLevel::AVX2;
+        }
+        if(__builtin_cpu_supports("sse4.2")){
+            return SimdLevel::SSE42;
+        }
+#endif
+        return SimdLevel::SCALAR;
+    }
+
+    // Detected once per process; every kernel dispatches on this.
+    inline SimdLevel simdLevel(){
+        static const SimdLevel level = detectSimdLevel();
+        return level;
+    }
+
+    // One bit per byte of a 64-byte block, bit i describing block[i].
+    struct BlockMasks{
+        uint64_t quote;
+        uint64_t backslash;
+        uint64_t whitespace;
+    };
+
+    inline BlockMasks classifyScalar(const char* block){
+        BlockMasks masks = {0, 0, 0};
+        for(size_t i = 0; i < BLOCK_SIZE; i++){
+            uint64_t bit = uint64_t(1) << i;
+            switch(block[i]){
+                case '\"': masks.quote |= bit; break;
+                case '\\': masks.backslash |= bit; break;
+                case ' ':
+                case '\n':
+                case '\t': masks.whitespace |= bit; break;
+                default: break;
+            }
+        }
+        return masks;
+    }
+
+#ifdef JSONSIMD_X86
+    __attribute__((target("sse4.2")))
+    inline BlockMasks classifySse42(const char* block){
+        const __m128i quote = _mm_set1_epi8('\"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i newLine = _mm_set1_epi8('\n');
+        const __m128i tab = _mm_set1_epi8('\t');
+        BlockMasks masks = {0, 0, 0};
+        for(size_t i = 0; i < BLOCK_SIZE; i += 16){
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+            __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(bytes, space),
+                         _mm_or_si128(_mm_cmpeq_epi8(bytes, newLine), _mm_cmpeq_epi8(bytes, tab)));
+            masks.quote |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quote)))) << i;
+            masks.backslash |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, backslash)))) << i;
+            masks.whitespace |= uint64_t(uint16_t(_mm_movemask_epi8(ws))) << i;
+        }
+        return masks;
+    }
+
+    __attribute__((target("avx2")))
+    inline BlockMasks classifyAvx2(const char* block){
+        const __m256i quote = _mm256_set1_epi8('\"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i space = _mm256_set1_epi8(' ');
+        const __m256i newLine = _mm256_set1_epi8('\n');
+        const __m256i tab = _mm256_set1_epi8('\t');
+        BlockMasks masks = {0, 0, 0};
+        for(size_t i = 0; i < BLOCK_SIZE; i += 32){
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+            __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, space),
+                         _mm256_or_si256(_mm256_cmpeq_epi8(bytes, newLine), _mm256_cmpeq_epi8(bytes, tab)));
+            masks.quote |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, quote)))) << i;
+            masks.backslash |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, backslash)))) << i;
+            masks.whitespace |= uint64_t(uint32_t(_mm256_movemask_epi8(ws))) << i;
+        }
+        return masks;
+    }
+#endif
+
+    inline BlockMasks classifyBlock(const char* block, SimdLevel level){
+#ifdef JSONSIMD_X86
+        switch(level){
+            case SimdLevel::AVX2: return classifyAvx2(block);
+            case SimdLevel::SSE42: return classifySse42(block);
+            default: break;
+        }
+#else
+        (void)level;
+#endif
+        return classifyScalar(block);
+    }
+
+    // Quotes, backslashes and the structural characters { } [ ] : , of a
+    // 64-byte block, for the structural index.
+    struct StructuralMasks{
+        uint64_t quote;
+        uint64_t backslash;
+        uint64_t structural;
+    };
+
+    inline StructuralMasks classifyStructuralScalar(const char* block){
+        StructuralMasks masks = {0, 0, 0};
+        for(size_t i = 0; i < BLOCK_SIZE; i++){
+            uint64_t bit = uint64_t(1) << i;
+            switch(block[i]){
+                case '\"': masks.quote |= bit; break;
+                case '\\': masks.backslash |= bit; break;
+                case '{':
+                case '}':
+                case '[':
+                case ']':
+                case ':':
+                case ',': masks.structural |= bit; break;
+                default: break;
+            }
+        }
+        return masks;
+    }
+
+#ifdef JSONSIMD_X86
+    // '[' and ']' differ from '{' and '}' only in bit 0x20, and no other byte
+    // sets that bit to land on either brace, so two compares cover all four.
+    __attribute__((target("sse4.2")))
+    inline StructuralMasks classifyStructuralSse42(const char* block){
+        const __m128i quote = _mm_set1_epi8('\"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i caseBit = _mm_set1_epi8(0x20);
+        const __m128i openBrace = _mm_set1_epi8('{');
+        const __m128i closeBrace = _mm_set1_epi8('}');
+        const __m128i colon = _mm_set1_epi8(':');
+        const __m128i comma = _mm_set1_epi8(',');
+        StructuralMasks masks = {0, 0, 0};
+        for(size_t i = 0; i < BLOCK_SIZE; i += 16){
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+            __m128i folded = _mm_or_si128(bytes, caseBit);
+            __m128i structural = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(folded, openBrace), _mm_cmpeq_epi8(folded, closeBrace)),
+                _mm_or_si128(_mm_cmpeq_epi8(bytes, colon), _mm_cmpeq_epi8(bytes, comma)));
+            masks.quote |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quote)))) << i;
+            masks.backslash |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, backslash)))) << i;
+            masks.structural |= uint64_t(uint16_t(_mm_movemask_epi8(structural))) << i;
+        }
+        return masks;
+    }
+
+    __attribute__((target("avx2")))
+    inline StructuralMasks classifyStructuralAvx2(const char* block){
+        const __m256i quote = _mm256_set1_epi8('\"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i caseBit = _mm256_set1_epi8(0x20);
+        const __m256i openBrace = _mm256_set1_epi8('{');
+        const __m256i closeBrace = _mm256_set1_epi8('}');
+        const __m256i colon = _mm256_set1_epi8(':');
+        const __m256i comma = _mm256_set1_epi8(',');
+        StructuralMasks masks = {0, 0, 0};
+        for(size_t i = 0; i < BLOCK_SIZE; i += 32){
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+            __m256i folded = _mm256_or_si256(bytes, caseBit);
+            __m256i structural = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(folded, openBrace), _mm256_cmpeq_epi8(folded, closeBrace)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(bytes, colon), _mm256_cmpeq_epi8(bytes, comma)));
+            masks.quote |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, quote)))) << i;
+            masks.backslash |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, backslash)))) << i;
+            masks.structural |= uint64_t(uint32_t(_mm256_movemask_epi8(structural))) << i;
+        }
+        return masks;
+    }
+#endif
+
+    inline StructuralMasks classifyStructural(const char* block, SimdLevel level){
+#ifdef JSONSIMD_X86
+        switch(level){
+            case SimdLevel::AVX2: return classifyStructuralAvx2(block);
+            case SimdLevel::SSE42: return classifyStructuralSse42(block);
+            default: break;
+        }
+#else
+        (void)level;
+#endif
+        return classifyStructuralScalar(block);
+    }
+
+    // Bit i of the result is the XOR of bits 0..i of the input.
+    inline uint64_t prefixXor(uint64_t bits){
+        bits ^= bits << 1;
+        bits ^= bits << 2;
+        bits ^= bits << 4;
+        bits ^= bits << 8;
+        bits ^= bits << 16;
+        bits ^= bits << 32;
+        return bits;
+    }
+
+    // Carries backslash-run parity and in-string state from one block to the next.
+    class StringTracker{
+        private:
+            uint64_t prevOddBackslash = 0;
+            uint64_t prevInString = 0;
+
+            // Bytes preceded by an odd-length run of backslashes, i.e. escaped.
+            uint64_t escapedBytes(uint64_t backslash){
+                const uint64_t evenBits = 0x5555555555555555ULL;
+                const uint64_t oddBits = ~evenBits;
+                uint64_t startEdges = backslash & ~(backslash << 1);
+                uint64_t evenStartMask = evenBits ^ prevOddBackslash;
+                uint64_t evenStarts = startEdges & evenStartMask;
+                uint64_t oddStarts = startEdges & ~evenStartMask;
+                uint64_t evenCarries = backslash + evenStarts;
+                uint64_t oddCarries = backslash + oddStarts;
+                bool endsOdd = oddCarries < backslash;
+                oddCarries |= prevOddBackslash;
+                prevOddBackslash = endsOdd ? 1 : 0;
+                uint64_t evenCarryEnds = evenCarries & ~backslash;
+                uint64_t oddCarryEnds = oddCarries & ~backslash;
+                return (evenCarryEnds & oddBits) | (oddCarryEnds & evenBits);
+            }
+
+        public:
+            StringTracker(bool startInString = false)
+            : prevInString(startInString ? ~uint64_t(0) : 0){}
+
+            // Mask of bytes inside strings: each opening quote and the body,
+            // but not the closing quote.
+            uint64_t next(uint64_t quote, uint64_t backslash){
+                uint64_t realQuotes = quote & ~escapedBytes(backslash);
+                uint64_t inString = prefixXor(realQuotes) ^ prevInString;
+                prevInString = static_cast<uint64_t>(static_cast<int64_t>(inString) >> 63);
+                return inString;
+            }
+
+            bool inString() const{
+                return prevInString != 0;
+            }
+    };
+
+    // For every 8-bit keep mask, the indices of its set bits packed to the
+    // front; used to compact eight bytes with a single byte shuffle.
+    struct CompactTable{
+        uint8_t shuffle[256][8];
+
+        constexpr CompactTable() : shuffle(){
+            for(int mask = 0; mask < 256; mask++){
+                int out = 0;
+                for(int bit = 0; bit < 8; bit++){
+                    if(mask & (1 << bit)){
+                        shuffle[mask][out++] = static_cast<uint8_t>(bit);
+                    }
+                }
+                for(; out < 8; out++){
+                    shuffle[mask][out] = 0x80;
+                }
+            }
+        }
+    };
+
+    inline const CompactTable& compactTable(){
+        static constexpr CompactTable table;
+        return table;
+    }
+
+    inline size_t compactScalar(const char* block, uint64_t keep, char* out){
+        size_t written = 0;
+        while(keep != 0){
+            out[written++] = block[__builtin_ctzll(keep)];
+            keep &= keep - 1;
+        }
+        return written;
+    }
+
+#ifdef JSONSIMD_X86
+    __attribute__((target("sse4.2")))
+    inline size_t compactShuffle(const char* block, uint64_t keep, char* out){
+        const CompactTable& table = compactTable();
+        size_t written = 0;
+        for(size_t i = 0; i < BLOCK_SIZE; i += 8){
+            unsigned mask = static_cast<unsigned>((keep >> i) & 0xFF);
+            __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(block + i));
+            __m128i order = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(table.shuffle[mask]));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out + written), _mm_shuffle_epi8(bytes, order));
+            written += __builtin_popcount(mask);
+        }
+        return written;
+    }
+#endif
+
+    // String state after the given bytes, as a Minifier would track it.
+    inline bool endsInString(const char* data, size_t len, bool startInString){
+        StringTracker tracker(startInString);
+        SimdLevel level = simdLevel();
+        size_t pos = 0;
+        for(; len - pos >= BLOCK_SIZE; pos += BLOCK_SIZE){
+            BlockMasks masks = classifyBlock(data + pos, level);
+            tracker.next(masks.quote, masks.backslash);
+        }
+        if(pos < len){
+            char block[BLOCK_SIZE];
+            std::memset(block, ' ', BLOCK_SIZE);
+            std::memcpy(block, data + pos, len - pos);
+            BlockMasks masks = classifyBlock(block, level);
+            tracker.next(masks.quote, masks.backslash);
+        }
+        return tracker.inString();
+    }
+
+    inline size_t findQuoteOrBackslashScalar(const char* data, size_t len){
+        size_t i = 0;
+        while(i < len && data[i] != '\"' && data[i] != '\\'){
+            i++;
+        }
+        return i;
+    }
+
+#ifdef JSONSIMD_X86
+    __attribute__((target("sse4.2")))
+    inline size_t findQuoteOrBackslashSse42(const char* data, size_t len){
+        const __m128i quote = _mm_set1_epi8('\"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        size_t i = 0;
+        for(; i + 16 <= len; i += 16){
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, quote), _mm_cmpeq_epi8(bytes, backslash)));
+            if(mask != 0){
+                return i + __builtin_ctz(mask);
+            }
+        }
+        return i + findQuoteOrBackslashScalar(data + i, len - i);
+    }
+
+    __attribute__((target("avx2")))
+    inline size_t findQuoteOrBackslashAvx2(const char* data, size_t len){
+        const __m256i quote = _mm256_set1_epi8('\"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        size_t i = 0;
+        for(; i + 32 <= len; i += 32){
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(bytes, quote), _mm256_cmpeq_epi8(bytes, backslash))));
+            if(mask != 0){
+                return i + __builtin_ctz(mask);
+            }
+        }
+        return i + findQuoteOrBackslashScalar(data + i, len - i);
+    }
+#endif
+
+    // Index of the first '"' or '\\' in data, or len if there is none. This is
+    // how far a string body can be copied before its state machine matters.
+    inline size_t findQuoteOrBackslash(const char* data, size_t len){
+#ifdef JSONSIMD_X86
+        switch(simdLevel()){
+            case SimdLevel::AVX2: return findQuoteOrBackslashAvx2(data, len);
+            case SimdLevel::SSE42: return findQuoteOrBackslashSse42(data, len);
+            default: break;
+        }
+#endif
+        return findQuoteOrBackslashScalar(data, len);
+    }
+
+    inline bool needsEscape(char ch){
+        return ch == '\"' || ch == '\\' || static_cast<unsigned char>(ch) < 0x20;
+    }
+
+    inline size_t findEscapableScalar(const char* data, size_t len){
+        size_t i = 0;
+        while(i < len && !needsEscape(data[i])){
+            i++;
+        }
+        return i;
+    }
+
+#ifdef JSONSIMD_X86
+    __attribute__((target("sse4.2")))
+    inline size_t findEscapableSse42(const char* data, size_t len){
+        const __m128i quote = _mm_set1_epi8('\"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1F);
+        size_t i = 0;
+        for(; i + 16 <= len; i += 16){
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            __m128i isControl = _mm_cmpeq_epi8(_mm_min_epu8(bytes, control), bytes);
+            int mask = _mm_movemask_epi8(_mm_or_si128(isControl,
+                _mm_or_si128(_mm_cmpeq_epi8(bytes, quote), _mm_cmpeq_epi8(bytes, backslash))));
+            if(mask != 0){
+                return i + __builtin_ctz(mask);
+            }
+        }
+        return i + findEscapableScalar(data + i, len - i);
+    }
+
+    __attribute__((target("avx2")))
+    inline size_t findEscapableAvx2(const char* data, size_t len){
+        const __m256i quote = _mm256_set1_epi8('\"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i control = _mm256_set1_epi8(0x1F);
+        size_t i = 0;
+        for(; i + 32 <= len; i += 32){
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i isControl = _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, control), bytes);
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(isControl,
+                _mm256_or_si256(_mm256_cmpeq_epi8(bytes, quote), _mm256_cmpeq_epi8(bytes, backslash)))));
+            if(mask != 0){
+                return i + __builtin_ctz(mask);
+            }
+        }
+        return i + findEscapableScalar(data + i, len - i);
+    }
+#endif
+
+    // Index of the first byte a JSON string cannot hold as is ('"', '\\' or a
+    // control character), or len if there is none.
+    inline size_t findEscapable(const char* data, size_t len){
+#ifdef JSONSIMD_X86
+        // Most keys and short values end before a vector would fill.
+        if(len < 16){
+            return findEscapableScalar(data, len);
+        }
+        switch(simdLevel()){
+            case SimdLevel::AVX2: return findEscapableAvx2(data, len);
+            case SimdLevel::SSE42: return findEscapableSse42(data, len);
+            default: break;
+        }
+#endif
+        return findEscapableScalar(data, len);
+    }
+
+    // Whitespace stripper working a 64-byte block at a time. The string state
+    // carries across calls, so blocks must be fed in input order.
+    class Minifier{
+        private:
+            StringTracker tracker;
+            SimdLevel level;
+
+        public:
+            Minifier(bool startInString = false, SimdLevel simd = simdLevel())
+            : tracker(startInString), level(simd){}
+
+            // Copies the bytes of block that survive minification to out and
+            // returns their count. out needs BLOCK_SIZE + 8 bytes of room. For a
+            // final short block, pad it to BLOCK_SIZE and pass the real bytes
+            // in validMask.
+            size_t minifyBlock(const char* block, char* out, uint64_t validMask = ~uint64_t(0)){
+                BlockMasks masks = classifyBlock(block, level);
+                uint64_t inString = tracker.next(masks.quote, masks.backslash);
+                uint64_t keep = (~masks.whitespace | inString) & validMask;
+                if(keep == ~uint64_t(0)){
+                    std::memcpy(out, block, BLOCK_SIZE);
+                    return BLOCK_SIZE;
+                }
+#ifdef JSONSIMD_X86
+                if(level != SimdLevel::SCALAR){
+                    return compactShuffle(block, keep, out);
+                }
+#endif
+                return compactScalar(block, keep, out);
+            }
+
+            bool inString() const{
+                return tracker.inString();
+            }
+    };
+}
@@ -0,0 +1,190 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define JSONSTATS_HAS_TSC 1
+#endif
+
+// Hot-path counters and phase timers, compiled in only when
+// JSONFMT_ENABLE_STATS is defined; otherwise every JSONSTATS_* hook below
+// expands to nothing. Counters are per thread: read them with
+// jsonstats::current() on the thread that ran Json(fileName), formatJson()
+// and so on. Work handed to other threads (parallel formatting, the
+// read-ahead and write-behind threads) is counted on those threads, except
+// for bytes and chunks, which are counted where the caller hands them over.
+namespace jsonstats {
+
+#ifdef JSONFMT_ENABLE_STATS
+    constexpr bool enabled = true;
+#else
+    constexpr bool enabled = false;
+#endif
+
+    // Time is charged to the innermost phase only: number conversion inside
+    // tokenizing inside tree building counts once, as NUMBER.
+    enum class Phase {
+        READ,
+        TOKENIZE,
+        NUMBER,
+        BUILD,
+        FORMAT,
+        WRITE,
+        COUNT
+    };
+
+    // Indexed by static_cast of jsontok::TokenType and
+    // jsonparse::JsonObjectType.
+    static const size_t TOKEN_TYPE_SLOTS = 11;
+    static const size_t OBJECT_TYPE_SLOTS = 3;
+
+    struct Stats {
+        uint64_t bytesRead = 0;
+        uint64_t chunksRead = 0;
+        uint64_t bytesWritten = 0;
+        uint64_t chunksWritten = 0;
+        uint64_t tokens[TOKEN_TYPE_SLOTS] = {};
+        // Nodes built; jsondom counts object keys too, as they are nodes there.
+        uint64_t nodes[OBJECT_TYPE_SLOTS] = {};
+        // Heap blocks requested by the parsers: tree nodes, arena and token
+        // storage growth.
+        uint64_t allocations = 0;
+        uint64_t phaseTicks[static_cast<size_t>(Phase::COUNT)] = {};
+
+        uint64_t totalTokens() const {
+            uint64_t total = 0;
+            for (uint64_t count : tokens)
+                total += count;
+            return total;
+        }
+    };
+
+    inline uint64_t ticks() {
+#ifdef JSONSTATS_HAS_TSC
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+
+    // Tick rate, measured once against steady_clock.
+    inline double ticksPerSecond() {
+        static const double rate = []() {
+            auto start = std::chrono::steady_clock::now();
+            uint64_t startTicks = ticks();
+            while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(10)) {
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return static_cast<double>(ticks() - startTicks) / seconds;
+        }();
+        return rate;
+    }
+
+    struct ThreadState {
+        Stats stats;
+        Phase active = Phase::COUNT; // COUNT: no phase running
+        uint64_t since = 0;
+    };
+
+    inline ThreadState& threadState() {
+        thread_local ThreadState state;
+        return state;
+    }
+
+    inline Stats& local() {
+        return threadState().stats;
+    }
+
+    // This thread's counters so far; all zero unless stats are enabled.
+    inline Stats current() {
+        return local();
+    }
+
+    inline void reset() {
+        local() = Stats();
+    }
+
+    inline double seconds(const Stats& stats, Phase phase) {
+        return stats.phaseTicks[static_cast<size_t>(phase)] / ticksPerSecond();
+    }
+
+    inline std::string report(const Stats& stats) {
+        static const char* tokenNames[TOKEN_TYPE_SLOTS] = {
+            "{", "}", "[", "]", "string", "number", "null", "bool", ",", ":", "eof"
+        };
+        static const char* nodeNames[OBJECT_TYPE_SLOTS] = {"object", "array", "literal"};
+        static const char* phaseNames[] = {"read", "tokenize", "number", "build", "format", "write"};
+        char line[128];
+        std::string text;
+        std::snprintf(line, sizeof(line), "read %llu bytes in %llu chunks, wrote %llu bytes in %llu chunks\n",
+                      static_cast<unsigned long long>(stats.bytesRead),
+                      static_cast<unsigned long long>(stats.chunksRead),
+                      static_cast<unsigned long long>(stats.bytesWritten),
+                      static_cast<unsigned long long>(stats.chunksWritten));
+        text += line;
+        text += "tokens:";
+        for (size_t i = 0; i < TOKEN_TYPE_SLOTS; i++) {
+            std::snprintf(line, sizeof(line), " %s=%llu", tokenNames[i], static_cast<unsigned long long>(stats.tokens[i]));
+            text += line;
+        }
+        text += "\nnodes:";
+        for (size_t i = 0; i < OBJECT_TYPE_SLOTS; i++) {
+            std::snprintf(line, sizeof(line), " %s=%llu", nodeNames[i], static_cast<unsigned long long>(stats.nodes[i]));
+            text += line;
+        }
+        std::snprintf(line, sizeof(line), " allocations=%llu\nseconds:", static_cast<unsigned long long>(stats.allocations));
+        text += line;
+        for (size_t i = 0; i < static_cast<size_t>(Phase::COUNT); i++) {
+            std::snprintf(line, sizeof(line), " %s=%.6f", phaseNames[i], seconds(stats, static_cast<Phase>(i)));
+            text += line;
+        }
+        text += '\n';
+        return text;
+    }
+
+    // Charges the time until it goes out of scope to phase, pausing the
+    // enclosing phase meanwhile.
+    class PhaseTimer {
+    private:
+        Phase outer;
+
+        static void charge(ThreadState& state, uint64_t now) {
+            if (state.active != Phase::COUNT)
+                state.stats.phaseTicks[static_cast<size_t>(state.active)] += now - state.since;
+            state.since = now;
+        }
+
+    public:
+        explicit PhaseTimer(Phase phase) {
+            ThreadState& state = threadState();
+            charge(state, ticks());
+            outer = state.active;
+            state.active = phase;
+        }
+
+        PhaseTimer(const PhaseTimer&) = delete;
+        PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+        ~PhaseTimer() {
+            ThreadState& state = threadState();
+            charge(state, ticks());
+            state.active = outer;
+        }
+    };
+}
+
+#ifdef JSONFMT_ENABLE_STATS
+#define JSONSTATS_ADD(field, amount) (::jsonstats::local().field += (amount))
+#define JSONSTATS_COUNT_TOKEN(type) (::jsonstats::local().tokens[static_cast<size_t>(type)]++)
+#define JSONSTATS_COUNT_NODE(type) (::jsonstats::local().nodes[static_cast<size_t>(type)]++)
+#define JSONSTATS_PHASE(phase) ::jsonstats::PhaseTimer jsonstatsPhaseTimer(::jsonstats::Phase::phase)
+#else
+#define JSONSTATS_ADD(field, amount) ((void)0)
+#define JSONSTATS_COUNT_TOKEN(type) ((void)0)
+#define JSONSTATS_COUNT_NODE(type) ((void)0)
+#define JSONSTATS_PHASE(phase) ((void)0)
+#endif
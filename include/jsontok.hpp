@@ -1,6 +1,17 @@
 #pragma once
 #include "fileutils.hpp"
+#include "jsonindex.hpp"
+#include "jsonsimd.hpp"
+#include "jsonstats.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace jsontok{
@@ -17,6 +28,112 @@ namespace jsontok{
         COLON,
         END_OF_FILE
     };
+    static_assert(static_cast<size_t>(TokenType::END_OF_FILE) + 1 == jsonstats::TOKEN_TYPE_SLOTS,
+                  "jsonstats token slots");
+
+    enum class NumberKind{
+        INT64,
+        UINT64,
+        DOUBLE
+    };
+
+    // A converted number literal. Integers that fit 64 bits are kept exactly;
+    // everything else (fractions, exponents, larger integers) is a double.
+    class NumberValue{
+        private:
+            NumberKind kind = NumberKind::INT64;
+            union{
+                int64_t i;
+                uint64_t u;
+                double d;
+            } value = {0};
+        public:
+            NumberValue(){}
+
+            static NumberValue fromInt64(int64_t v){
+                NumberValue n;
+                n.kind = NumberKind::INT64;
+                n.value.i = v;
+                return n;
+            }
+
+            static NumberValue fromUint64(uint64_t v){
+                NumberValue n;
+                n.kind = NumberKind::UINT64;
+                n.value.u = v;
+                return n;
+            }
+
+            static NumberValue fromDouble(double v){
+                NumberValue n;
+                n.kind = NumberKind::DOUBLE;
+                n.value.d = v;
+                return n;
+            }
+
+            NumberKind getKind() const{
+                return kind;
+            }
+
+            // Raw 64 bits of whichever member is active.
+            uint64_t getBits() const{
+                return value.u;
+            }
+
+            static NumberValue fromBits(NumberKind kind, uint64_t bits){
+                NumberValue n;
+                n.kind = kind;
+                n.value.u = bits;
+                return n;
+            }
+
+            double asDouble() const{
+                switch(kind){
+                    case NumberKind::INT64: return static_cast<double>(value.i);
+                    case NumberKind::UINT64: return static_cast<double>(value.u);
+                    default: return value.d;
+                }
+            }
+
+            // Throws unless the value is an integer representable as int64_t.
+            int64_t asInt64() const{
+                switch(kind){
+                    case NumberKind::INT64:
+                        return value.i;
+                    case NumberKind::UINT64:
+                        if(value.u > static_cast<uint64_t>(INT64_MAX)){
+                            throw std::runtime_error("Number out of int64 range");
+                        }
+                        return static_cast<int64_t>(value.u);
+                    default:
+                        // 2^63 is exactly representable; anything below it converts exactly.
+                        if(!(value.d >= -9223372036854775808.0 && value.d < 9223372036854775808.0) ||
+                           static_cast<double>(static_cast<int64_t>(value.d)) != value.d){
+                            throw std::runtime_error("Number is not an int64");
+                        }
+                        return static_cast<int64_t>(value.d);
+                }
+            }
+
+            // Throws unless the value is an integer representable as uint64_t.
+            uint64_t asUint64() const{
+                switch(kind){
+                    case NumberKind::INT64:
+                        if(value.i < 0){
+                            throw std::runtime_error("Number out of uint64 range");
+                        }
+                        return static_cast<uint64_t>(value.i);
+                    case NumberKind::UINT64:
+                        return value.u;
+                    default:
+                        if(!(value.d >= 0 && value.d < 18446744073709551616.0) ||
+                           static_cast<double>(static_cast<uint64_t>(value.d)) != value.d){
+                            throw std::runtime_error("Number is not a uint64");
+                        }
+                        return static_cast<uint64_t>(value.d);
+                }
+            }
+    };
 
     class NumberParser{
         private:
@@ -36,7 +153,7 @@ namespace jsontok{
             static bool isDigit(char ch){
                 return ch >= '0' && ch <= '9';
             }
-            static bool isRealNum(std::string& num){
+            static bool isRealNum(std::string_view num){
                 int index = 0;
                 char ch;
                 NumberParserContext cntx = NumberParserContext::START;
@@ -185,17 +302,264 @@ namespace jsontok{
                 }
                 return false;
             }
+
+            // The power of ten just above the mantissa's first non-zero
+            // digit: 2 for "12.5", 0 for "0.5", -2 for "0.005". Leading
+            // zeros do not count, wherever they are.
+            static long leadingMagnitude(const char* p, const char* end){
+                long position = 0;
+                bool fraction = false;
+                for(; p != end && *p != 'e' && *p != 'E'; p++){
+                    if(*p == '.'){
+                        fraction = true;
+                        continue;
+                    }
+                    if(*p != '0'){
+                        break;
+                    }
+                    if(fraction){
+                        position--;
+                    }
+                }
+                if(fraction){
+                    return position;
+                }
+                // The first non-zero digit is in the integer part.
+                long significant = 0;
+                for(; p != end && isDigit(*p); p++){
+                    significant++;
+                }
+                return significant;
+            }
+
+            // Validates num against the same grammar as isRealNum and converts
+            // it in the same pass. Integers go to int64/uint64 exactly; other
+            // values take the exact fast path when the significand fits in 53
+            // bits and the power of ten is at most 22 (both are then exact
+            // doubles, so one multiply or divide rounds correctly), and fall
+            // back to from_chars otherwise.
+            static bool parseNumber(std::string_view num, NumberValue& out){
+                JSONSTATS_PHASE(NUMBER);
+                static const double powersOfTen[] = {
+                    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+                };
+                const char* p = num.data();
+                const char* end = p + num.size();
+                bool negative = false;
+                if(p != end && (*p == '+' || *p == '-')){
+                    negative = *p == '-';
+                    p++;
+                }
+                const char* digitsStart = p;
+
+                uint64_t significand = 0;
+                int digits = 0;
+                bool overflow = false;
+                while(p != end && isDigit(*p)){
+                    unsigned d = *p - '0';
+                    if(significand > (UINT64_MAX - d) / 10){
+                        overflow = true;
+                    }
+                    else{
+                        significand = significand * 10 + d;
+                    }
+                    digits++;
+                    p++;
+                }
+                bool integral = true;
+                int fractionDigits = 0;
+                if(p != end && *p == '.'){
+                    integral = false;
+                    p++;
+                    while(p != end && isDigit(*p)){
+                        unsigned d = *p - '0';
+                        if(!overflow && significand > (UINT64_MAX - d) / 10){
+                            overflow = true;
+                        }
+                        else if(!overflow){
+                            significand = significand * 10 + d;
+                            fractionDigits++;
+                        }
+                        digits++;
+                        p++;
+                    }
+                    // ".", "-." and friends; "1." and ".5" are accepted as before.
+                    if(digits == 0){
+                        return false;
+                    }
+                }
+                else if(digits == 0){
+                    return false;
+                }
+
+                int exponent = 0;
+                if(p != end && (*p == 'e' || *p == 'E')){
+                    integral = false;
+                    p++;
+                    bool negativeExponent = false;
+                    if(p != end && (*p == '+' || *p == '-')){
+                        negativeExponent = *p == '-';
+                        p++;
+                    }
+                    if(p == end || !isDigit(*p)){
+                        return false;
+                    }
+                    while(p != end && isDigit(*p)){
+                        if(exponent < 100000){
+                            exponent = exponent * 10 + (*p - '0');
+                        }
+                        p++;
+                    }
+                    if(negativeExponent){
+                        exponent = -exponent;
+                    }
+                }
+                if(p != end){
+                    return false;
+                }
+
+                if(integral && !overflow){
+                    if(!negative){
+                        if(significand <= static_cast<uint64_t>(INT64_MAX)){
+                            out = NumberValue::fromInt64(static_cast<int64_t>(significand));
+                        }
+                        else{
+                            out = NumberValue::fromUint64(significand);
+                        }
+                        return true;
+                    }
+                    // "-0" stays a double so the sign survives.
+                    if(significand != 0 && significand <= static_cast<uint64_t>(INT64_MAX) + 1){
+                        out = NumberValue::fromInt64(static_cast<int64_t>(0 - significand));
+                        return true;
+                    }
+                }
+
+                exponent -= fractionDigits;
+                if(!overflow && significand <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22){
+                    double value = static_cast<double>(significand);
+                    value = exponent < 0 ? value / powersOfTen[-exponent] : value * powersOfTen[exponent];
+                    out = NumberValue::fromDouble(negative ? -value : value);
+                    return true;
+                }
+
+                // from_chars takes neither a leading '+' nor a leading '.'
+                // without digits before it, so hand it the unsigned text.
+                double value = 0;
+                auto result = std::from_chars(digitsStart, end, value);
+                if(result.ec == std::errc::result_out_of_range){
+                    // Rough decimal magnitude is enough to tell underflow from overflow.
+                    long magnitude = leadingMagnitude(digitsStart, end) + exponent + fractionDigits;
+                    value = magnitude <= 0 ? 0.0 : HUGE_VAL;
+                }
+                else if(result.ec != std::errc() || result.ptr != end){
+                    return false;
+                }
+                out = NumberValue::fromDouble(negative ? -value : value);
+                return true;
+            }
     };
 
+    // Decodes the escape sequences of a raw string token body. \uXXXX escapes
+    // (including surrogate pairs) come out as UTF-8.
+    inline std::string unescapeString(std::string_view raw){
+        std::string out;
+        out.reserve(raw.size());
+        auto hexValue = [&](size_t at){
+            if(at + 4 > raw.size()){
+                throw std::runtime_error("Truncated \\u escape in string: " + std::string(raw));
+            }
+            unsigned value = 0;
+            for(size_t i = at; i < at + 4; i++){
+                char ch = raw[i];
+                value <<= 4;
+                if(ch >= '0' && ch <= '9') value |= ch - '0';
+                else if(ch >= 'a' && ch <= 'f') value |= ch - 'a' + 10;
+                else if(ch >= 'A' && ch <= 'F') value |= ch - 'A' + 10;
+                else throw std::runtime_error("Invalid \\u escape in string: " + std::string(raw));
+            }
+            return value;
+        };
+        size_t pos = 0;
+        while(pos < raw.size()){
+            size_t run = raw.find('\\', pos);
+            if(run == std::string_view::npos){
+                run = raw.size();
+            }
+            out.append(raw.data() + pos, run - pos);
+            pos = run;
+            if(pos >= raw.size()){
+                break;
+            }
+            if(pos + 1 >= raw.size()){
+                throw std::runtime_error("Dangling escape in string: " + std::string(raw));
+            }
+            char escaped = raw[pos + 1];
+            pos += 2;
+            switch(escaped){
+                case '\"': out += '\"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u':{
+                    unsigned codePoint = hexValue(pos);
+                    pos += 4;
+                    if(codePoint >= 0xD800 && codePoint <= 0xDBFF && pos + 1 < raw.size()
+                       && raw[pos] == '\\' && raw[pos + 1] == 'u'){
+                        unsigned low = hexValue(pos + 2);
+                        if(low >= 0xDC00 && low <= 0xDFFF){
+                            codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                            pos += 6;
+                        }
+                    }
+                    if(codePoint < 0x80){
+                        out += static_cast<char>(codePoint);
+                    }
+                    else if(codePoint < 0x800){
+                        out += static_cast<char>(0xC0 | (codePoint >> 6));
+                        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+                    }
+                    else if(codePoint < 0x10000){
+                        out += static_cast<char>(0xE0 | (codePoint >> 12));
+                        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+                        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+                    }
+                    else{
+                        out += static_cast<char>(0xF0 | (codePoint >> 18));
+                        out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+                        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+                        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+                    }
+                    break;
+                }
+                default:
+                    throw std::runtime_error(std::string("Invalid escape sequence in string: \\") + escaped);
+            }
+        }
+        return out;
+    }
+
+    // A token is its type plus a view of its text. Punctuation and literals
+    // view static strings; strings (body only, escapes still encoded) and
+    // numbers view the input itself when it is memory mapped, otherwise
+    // storage owned by the tokenizer. See each tokenizer for how long that is.
     class Token{
         private:
             TokenType tokenType;
-            std::string rawTokenValue;
+            std::string_view rawTokenValue;
+            NumberValue numberValue;
         public:
-            Token(std::string tokenValue, TokenType type){
-                rawTokenValue = tokenValue;
-                tokenType = type;
-            }
+            Token(std::string_view tokenValue, TokenType type)
+            : tokenType(type), rawTokenValue(tokenValue){}
+
+            // A NUMBER token, already converted by NumberParser::parseNumber.
+            Token(std::string_view tokenValue, NumberValue number)
+            : tokenType(TokenType::NUMBER), rawTokenValue(tokenValue), numberValue(number){}
             
             Token(){}
 
@@ -203,214 +567,391 @@ namespace jsontok{
                 return tokenType;
             }
 
-            std::string getRawTokenValue() const{
+            std::string_view getRawTokenValue() const{
                 return rawTokenValue;
             }
+
+            const NumberValue& getNumberValue() const{
+                return numberValue;
+            }
+
+            std::string decodeString() const{
+                return unescapeString(rawTokenValue);
+            }
     };
 
-    
+    // Scans a string body for its closing quote, honouring escapes. Returns the
+    // quote's index, or npos if text ends first; isEscape carries a trailing
+    // unpaired backslash over to the next piece of the same string.
+    inline size_t findStringEnd(std::string_view text, bool& isEscape){
+        size_t pos = 0;
+        if(isEscape){
+            if(text.empty()){
+                return std::string_view::npos;
+            }
+            isEscape = false;
+            pos = 1;
+        }
+        while(true){
+            pos += jsonsimd::findQuoteOrBackslash(text.data() + pos, text.size() - pos);
+            if(pos >= text.size()){
+                return std::string_view::npos;
+            }
+            if(text[pos] == '\"'){
+                return pos;
+            }
+            if(pos + 1 >= text.size()){
+                isEscape = true;
+                return std::string_view::npos;
+            }
+            pos += 2;
+        }
+    }
+
+    inline bool isNumberChar(char ch){
+        return (ch >= '0' && ch <= '9') || ch == '.' || ch == 'e' || ch == 'E' || ch == '+' || ch == '-';
+    }
+
+    // Read-only view of a token tape: one 64-bit entry per token, the type in
+    // the top 8 bits and a 56-bit payload below it, and for strings and
+    // numbers a second entry after it.
+    //   STRING  payload = offset of the body in the text; then its length
+    //   NUMBER  payload = offset of the text (low 40 bits), its length (next
+    //           14 bits, all ones if longer) and NumberKind (top 2 bits);
+    //           then the converted value's bits
+    //   BOOL    payload = 1 for true, 0 for false
+    //   others  no payload
+    // Offsets are into one shared text buffer, so the tape holds no pointers.
+    // Tokens are materialized while iterating without looking at their text.
+    class TokenTape{
+        private:
+            static const int TYPE_SHIFT = 56;
+            static const uint64_t PAYLOAD_MASK = (uint64_t(1) << TYPE_SHIFT) - 1;
+            static const int NUMBER_LENGTH_SHIFT = 40;
+            static const int NUMBER_KIND_SHIFT = 54;
+            static const uint64_t NUMBER_LENGTH_MAX = (uint64_t(1) << (NUMBER_KIND_SHIFT - NUMBER_LENGTH_SHIFT)) - 1;
 
+            const uint64_t* entries = nullptr;
+            size_t entryCount = 0;
+            const char* text = nullptr;
+            size_t textSize = 0;
+
+        public:
+            static const uint64_t MAX_NUMBER_OFFSET = (uint64_t(1) << NUMBER_LENGTH_SHIFT) - 1;
+
+            static uint64_t makeEntry(TokenType type, uint64_t payload = 0){
+                return (static_cast<uint64_t>(type) << TYPE_SHIFT) | payload;
+            }
+
+            // First entry of a NUMBER; offset must not exceed MAX_NUMBER_OFFSET.
+            static uint64_t makeNumberEntry(uint64_t offset, size_t length, NumberKind kind){
+                uint64_t storedLength = length < NUMBER_LENGTH_MAX ? length : NUMBER_LENGTH_MAX;
+                return makeEntry(TokenType::NUMBER, offset | (storedLength << NUMBER_LENGTH_SHIFT) |
+                                 (static_cast<uint64_t>(kind) << NUMBER_KIND_SHIFT));
+            }
+
+            class Iterator{
+                private:
+                    const TokenTape* tape;
+                    size_t pos;
+
+                public:
+                    Iterator(const TokenTape* owner, size_t start) : tape(owner), pos(start){}
+
+                    Token operator*() const{
+                        return tape->tokenAt(pos);
+                    }
+
+                    Iterator& operator++(){
+                        pos = tape->next(pos);
+                        return *this;
+                    }
+
+                    bool operator==(const Iterator& other) const{
+                        return pos == other.pos;
+                    }
+
+                    bool operator!=(const Iterator& other) const{
+                        return pos != other.pos;
+                    }
+            };
+
+            TokenTape(){}
+            TokenTape(const uint64_t* tapeEntries, size_t count, const char* textBase, size_t textLength)
+            : entries(tapeEntries), entryCount(count), text(textBase), textSize(textLength){}
+
+            Iterator begin() const{
+                return Iterator(this, 0);
+            }
+
+            Iterator end() const{
+                return Iterator(this, entryCount);
+            }
+
+            // Number of entries, END_OF_FILE included; not the number of
+            // tokens, as strings and numbers take two.
+            size_t size() const{
+                return entryCount;
+            }
+
+            const uint64_t* data() const{
+                return entries;
+            }
+
+            TokenType typeAt(size_t pos) const{
+                return static_cast<TokenType>(entries[pos] >> TYPE_SHIFT);
+            }
+
+            // Position of the token after the one at pos.
+            size_t next(size_t pos) const{
+                TokenType type = typeAt(pos);
+                return pos + (type == TokenType::STRING || type == TokenType::NUMBER ? 2 : 1);
+            }
+
+            Token tokenAt(size_t pos) const{
+                TokenType type = typeAt(pos);
+                uint64_t payload = entries[pos] & PAYLOAD_MASK;
+                switch(type){
+                    case TokenType::STRING:
+                        return Token(std::string_view(text + payload, entries[pos + 1]), type);
+                    case TokenType::NUMBER:{
+                        size_t start = payload & MAX_NUMBER_OFFSET;
+                        size_t length = (payload >> NUMBER_LENGTH_SHIFT) & NUMBER_LENGTH_MAX;
+                        if(length == NUMBER_LENGTH_MAX){
+                            while(start + length < textSize && isNumberChar(text[start + length])){
+                                length++;
+                            }
+                        }
+                        NumberKind kind = static_cast<NumberKind>(payload >> NUMBER_KIND_SHIFT);
+                        return Token(std::string_view(text + start, length), NumberValue::fromBits(kind, entries[pos + 1]));
+                    }
+                    case TokenType::BOOL:
+                        return Token(payload ? "true" : "false", type);
+                    case TokenType::OPEN_BRACE: return Token("{", type);
+                    case TokenType::CLOSE_BRACE: return Token("}", type);
+                    case TokenType::OPEN_BRACK: return Token("[", type);
+                    case TokenType::CLOSE_BRACK: return Token("]", type);
+                    case TokenType::COMMA: return Token(",", type);
+                    case TokenType::COLON: return Token(":", type);
+                    case TokenType::NULL_VAL: return Token("null", type);
+                    default: return Token("$", TokenType::END_OF_FILE);
+                }
+            }
+    };
+
+    // Tokenizes a whole file up front into a TokenTape. Mapped input is its
+    // own text buffer, so strings and numbers are not copied at all; other
+    // input has its token text appended to one buffer owned by the
+    // tokenizer. The tape is reserved from the file size when it is known.
     class JsonStreamTokenizer{
         private:
             enum class TokenizerContext{
                 NORMAL,
                 NUMBER,
+                LITERAL,
                 STRING
             };
             fileutils::InputFileReader reader;
-            std::vector<Token> tokenStream;
+            std::vector<uint64_t> tape;
+            std::string text;
+
+            const char* textBase() const{
+                return reader.isMapped() ? reader.fileView().data() : text.data();
+            }
+
+            size_t textSize() const{
+                return reader.isMapped() ? reader.fileView().size() : text.size();
+            }
+
+            // Offset of token text in the text buffer, copying it there
+            // unless it already lies in the mapping.
+            uint64_t place(std::string_view body){
+                if(reader.isMapped()){
+                    return static_cast<uint64_t>(body.data() - reader.fileView().data());
+                }
+                uint64_t offset = text.size();
+                text.append(body.data(), body.size());
+                return offset;
+            }
+
+            void pushString(std::string_view body){
+                tape.push_back(TokenTape::makeEntry(TokenType::STRING, place(body)));
+                tape.push_back(body.size());
+            }
+
+            void pushNumber(std::string_view body){
+                NumberValue number;
+                if(!NumberParser::parseNumber(body, number)){
+                    throw std::runtime_error(std::string("Invalid numeric format encountered: ") + std::string(body));
+                }
+                uint64_t offset = place(body);
+                if(offset > TokenTape::MAX_NUMBER_OFFSET){
+                    throw std::runtime_error("Input too large for the token tape");
+                }
+                tape.push_back(TokenTape::makeNumberEntry(offset, body.size(), number.getKind()));
+                tape.push_back(number.getBits());
+                if(!reader.isMapped()){
+                    text.push_back(' '); // ends the number for TokenTape
+                }
+            }
+
+            void pushLiteral(std::string_view word){
+                if(word == "null"){
+                    tape.push_back(TokenTape::makeEntry(TokenType::NULL_VAL));
+                }
+                else if(word == "true"){
+                    tape.push_back(TokenTape::makeEntry(TokenType::BOOL, 1));
+                }
+                else if(word == "false"){
+                    tape.push_back(TokenTape::makeEntry(TokenType::BOOL, 0));
+                }
+                else{
+                    throw std::runtime_error(std::string("Invalid literal found while parsing: ") + std::string(word));
+                }
+            }
+
+            static bool isLiteralChar(char ch){
+                return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+            }
 
         public:
+            // Token views stay valid for the lifetime of the tokenizer.
             JsonStreamTokenizer(std::string fileName) : reader(fileName){}
 
-            std::vector<Token> getTokenStream(){
-                return tokenStream;
+            JsonStreamTokenizer(const JsonStreamTokenizer&) = delete;
+            JsonStreamTokenizer& operator=(const JsonStreamTokenizer&) = delete;
+
+            // The tokens, without copying; valid for the tokenizer's lifetime.
+            TokenTape getTape() const{
+                return TokenTape(tape.data(), tape.size(), textBase(), textSize());
+            }
+
+            // The tape materialized as Token objects.
+            std::vector<Token> getTokenStream() const{
+                std::vector<Token> tokens;
+                for(Token token : getTape()){
+                    tokens.push_back(token);
+                }
+                return tokens;
             }
 
             void startTokenizing(){
+                JSONSTATS_PHASE(TOKENIZE);
+                // One entry per 6 input bytes covers typical documents; denser
+                // input grows the tape as usual.
+                tape.reserve(reader.expectedSize() / 6 + 16);
+                // Token text straddling two chunks (buffered input only).
                 std::string buffer;
                 TokenizerContext cntx = TokenizerContext::NORMAL;
-                char nextChar;
                 bool isEscape = false;
 
                 while(true){
-                    nextChar = reader.readNextChar();
-                    if(reader.isEof()){
+                    std::string_view chunk = reader.currentChunk();
+                    if(chunk.empty()){
                         break;
                     }
                     switch(cntx){
-                        case TokenizerContext::NORMAL:{
-                            switch(nextChar){
-                                case '{':{
-                                    tokenStream.push_back(Token("{",TokenType::OPEN_BRACE));
-                                    break;
-                                }
-                                case '[':{
-                                    tokenStream.push_back(Token("[",TokenType::OPEN_BRACK));
-                                    break;
-                                }
-                                case ']':{
-                                    tokenStream.push_back(Token("]",TokenType::CLOSE_BRACK));
-                                    break;
-                                }
-                                case '}':{
-                                    tokenStream.push_back(Token("}",TokenType::CLOSE_BRACE));
-                                    break;
-                                }
-                                case ':':{
-                                    tokenStream.push_back(Token(":",TokenType::COLON));
-                                    break;
-                                }
-                                case ',':{
-                                    tokenStream.push_back(Token(",",TokenType::COMMA));
-                                    break;
-                                }
-                                case ' ':
-                                case '\n':
-                                case '\r':
-                                case '\t':{
-                                    break;
-                                }
-                                case '\"':{
-                                    cntx = TokenizerContext::STRING;
-                                    buffer.clear();
-                                    break;
-                                }
-                                case '-':
-                                case '0':
-                                case '1':
-                                case '2':
-                                case '3':
-                                case '4':
-                                case '5':
-                                case '6':
-                                case '7':
-                                case '8':
-                                case '9':{
-                                    cntx = TokenizerContext::NUMBER;
-                                    buffer.clear();
-                                    buffer += nextChar;
-                                    break;
-                                }
-                                default:{
-                                    if(!isalpha(nextChar)){
-                                        throw std::runtime_error(std::string("Invalid character in JSON context: ") + nextChar);
-                                    }
-                                    buffer += nextChar;
-                                    if(buffer.size() == 4){
-                                        if(buffer == "null"){
-                                            tokenStream.push_back(Token("null",TokenType::NULL_VAL));
-                                            buffer.clear();
-                                        }
-                                        else if(buffer == "true"){
-                                            tokenStream.push_back(Token("true",TokenType::BOOL));
-                                            buffer.clear();
-                                        }
-                                        else if(buffer != "fals"){
-                                            throw std::runtime_error(std::string("Invalid literal found while parsing: ") + buffer);
-                                        }
-
-                                    }
-                                    else if(buffer.size() == 5){
-                                        if(buffer != "false"){
-                                            throw std::runtime_error(std::string("Invalid literal found while parsing: ") + buffer);
-                                        }
-                                        else{
-                                            tokenStream.push_back(Token("false",TokenType::BOOL));
-                                            buffer.clear();
-                                        }
-                                    }
-                                    
-                                    break;
-                                }
+                        case TokenizerContext::STRING:{
+                            size_t end = findStringEnd(chunk, isEscape);
+                            if(end == std::string_view::npos){
+                                buffer.append(chunk.data(), chunk.size());
+                                reader.advance(chunk.size());
+                                break;
+                            }
+                            if(buffer.empty()){
+                                pushString(chunk.substr(0, end));
+                            }
+                            else{
+                                buffer.append(chunk.data(), end);
+                                pushString(buffer);
+                                buffer.clear();
                             }
+                            reader.advance(end + 1);
+                            cntx = TokenizerContext::NORMAL;
                             break;
                         }
-                        case TokenizerContext::STRING:{
-                            switch(nextChar){
-                                case '\\':{
-                                    isEscape = true;
-                                    buffer += '\\';
-                                    break;
-                                }
-                                case '\"':{
-                                    if(!isEscape){
-                                        tokenStream.push_back(Token(buffer.data(), TokenType::STRING));
-                                        buffer.clear();
-                                        cntx = TokenizerContext::NORMAL;
-                                        break;
-                                    }
-                                    else{
-                                        isEscape = false;
-                                        buffer += '\"';
-                                        break;
-                                    }
-                                }
-                                default:{
-                                    buffer += nextChar;
-                                    break;
-                                }
+                        case TokenizerContext::NUMBER:
+                        case TokenizerContext::LITERAL:{
+                            bool number = cntx == TokenizerContext::NUMBER;
+                            size_t end = 0;
+                            while(end < chunk.size() && (number ? isNumberChar(chunk[end]) : isLiteralChar(chunk[end]))){
+                                end++;
+                            }
+                            // A mapped file is one chunk, so its end is the end of input.
+                            if(end == chunk.size() && !reader.isMapped()){
+                                buffer.append(chunk.data(), chunk.size());
+                                reader.advance(chunk.size());
+                                break;
+                            }
+                            std::string_view body = chunk.substr(0, end);
+                            if(!buffer.empty()){
+                                buffer.append(chunk.data(), end);
+                                body = buffer;
                             }
+                            if(number){
+                                pushNumber(body);
+                            }
+                            else{
+                                pushLiteral(body);
+                            }
+                            buffer.clear();
+                            reader.advance(end);
+                            cntx = TokenizerContext::NORMAL;
                             break;
                         }
-                        case TokenizerContext::NUMBER:{
-                            switch(nextChar){
-                                case ' ':
-                                case '\n':
-                                case '\r':
-                                case '\t':{
-                                    break;
-                                }
-                                case ',':
-                                case ']':
-                                case '}':{
-                                    if(!NumberParser::isRealNum(buffer)){
-                                        throw std::runtime_error(std::string("Invalid numeric format encountered: ") + buffer);
-                                    }
-                                    tokenStream.push_back(Token(buffer.data(), TokenType::NUMBER));
-                                    buffer.clear();
-                                    cntx = TokenizerContext::NORMAL;
-                                    switch(nextChar){
-                                        case ']':{
-                                            tokenStream.push_back(Token("]",TokenType::CLOSE_BRACK));
-                                            break;
+                        case TokenizerContext::NORMAL:{
+                            size_t pos = 0;
+                            while(pos < chunk.size() && cntx == TokenizerContext::NORMAL){
+                                char nextChar = chunk[pos];
+                                switch(nextChar){
+                                    case '{': tape.push_back(TokenTape::makeEntry(TokenType::OPEN_BRACE)); pos++; break;
+                                    case '[': tape.push_back(TokenTape::makeEntry(TokenType::OPEN_BRACK)); pos++; break;
+                                    case ']': tape.push_back(TokenTape::makeEntry(TokenType::CLOSE_BRACK)); pos++; break;
+                                    case '}': tape.push_back(TokenTape::makeEntry(TokenType::CLOSE_BRACE)); pos++; break;
+                                    case ':': tape.push_back(TokenTape::makeEntry(TokenType::COLON)); pos++; break;
+                                    case ',': tape.push_back(TokenTape::makeEntry(TokenType::COMMA)); pos++; break;
+                                    case ' ':
+                                    case '\n':
+                                    case '\r':
+                                    case '\t':
+                                        pos++;
+                                        break;
+                                    case '\"':
+                                        cntx = TokenizerContext::STRING;
+                                        pos++;
+                                        break;
+                                    default:
+                                        // Left in place: the NUMBER/LITERAL branch collects it.
+                                        if(nextChar == '-' || (nextChar >= '0' && nextChar <= '9')){
+                                            cntx = TokenizerContext::NUMBER;
                                         }
-                                        case '}':{
-                                            tokenStream.push_back(Token("}",TokenType::CLOSE_BRACE));
-                                            break;
+                                        else if(isLiteralChar(nextChar)){
+                                            cntx = TokenizerContext::LITERAL;
                                         }
-                                        case ',':{
-                                            tokenStream.push_back(Token(",",TokenType::COMMA));
-                                            break;
+                                        else{
+                                            throw std::runtime_error(std::string("Invalid character in JSON context: ") + nextChar);
                                         }
-                                    }
-                                    break;
-                                }
-                                case '-':
-                                case 'E':
-                                case 'e':
-                                case '.':
-                                case '+':{
-                                    buffer += nextChar;
-                                    break;
                                 }
-                                default:{
-                                    if(isdigit(nextChar)){
-                                        buffer += nextChar;
-                                        break;
-                                    }
-                                    else{
-                                        throw std::runtime_error(std::string("Unexpected character inside number: ") + nextChar);
-                                    }
-                                    break;
-                                }
-
                             }
+                            reader.advance(pos);
                             break;
                         }
                     }
                 }
-                tokenStream.push_back(Token("$",TokenType::END_OF_FILE));
+                // A number or literal running up to the end of buffered input.
+                if(cntx == TokenizerContext::NUMBER){
+                    pushNumber(buffer);
+                }
+                else if(cntx == TokenizerContext::LITERAL){
+                    pushLiteral(buffer);
+                }
+                tape.push_back(TokenTape::makeEntry(TokenType::END_OF_FILE));
+#ifdef JSONFMT_ENABLE_STATS
+                TokenTape view = getTape();
+                for(size_t pos = 0; pos < view.size(); pos = view.next(pos)){
+                    JSONSTATS_COUNT_TOKEN(view.typeAt(pos));
+                }
+#endif
             }
         
     };
@@ -420,33 +961,108 @@ namespace jsontok{
             enum class TokenizerContext{
                 NORMAL,
                 NUMBER,
-                STRING
+                STRING,
+                LITERAL
             };
             fileutils::InputFileReader reader;
             Token peek;
             bool shouldConsume = true;
+            // Scan state carried between chunks; buffer holds a token that
+            // straddles a chunk boundary.
+            std::string buffer;
+            TokenizerContext cntx = TokenizerContext::NORMAL;
+            bool isEscape = false;
+            const jsonindex::StructuralIndex* structure = nullptr;
 
-            Token processNextToken() {
-                static std::string buffer;
-                static TokenizerContext cntx = TokenizerContext::NORMAL;
-                static bool isEscape = false;
-                static char unProcessed;
-                static bool unProcessedCharPresent = false;
+            bool isBlank(size_t from, size_t to){
+                std::string_view whole = reader.wholeInput();
+                for(size_t i = from; i < to; i++){
+                    char ch = whole[i];
+                    if(ch != ' ' && ch != '\n' && ch != '\r' && ch != '\t'){
+                        return false;
+                    }
+                }
+                return true;
+            }
 
-                while (true) {
-                    char nextChar = 0;
-                    if(!unProcessedCharPresent){
-                        nextChar = reader.readNextChar();
+            // skipContainer() through the index: the structural character
+            // before the read position names the container to leave.
+            void skipContainerIndexed(){
+                size_t pos = reader.position();
+                size_t entry = structure->find(pos);
+                size_t before = entry;
+                if(!shouldConsume){
+                    shouldConsume = true;
+                    TokenType type = peek.getTokenType();
+                    if(type == TokenType::CLOSE_BRACE || type == TokenType::CLOSE_BRACK){
+                        return;
                     }
-                    else{
-                        nextChar = unProcessed;
-                        unProcessedCharPresent = false;
+                    // A peeked opener is a container of its own to leave.
+                    if(type == TokenType::OPEN_BRACE || type == TokenType::OPEN_BRACK){
+                        before--;
                     }
-                    if (reader.isEof()) {
+                }
+                if(before == 0){
+                    throw std::runtime_error("Unexpected end of input inside a container");
+                }
+                size_t closer = structure->enclosingCloser(before - 1);
+                reader.advance(structure->offset(closer) + 1 - pos);
+            }
+
+            Token processNextToken() {
+                JSONSTATS_PHASE(TOKENIZE);
+                Token token = scanNextToken();
+                JSONSTATS_COUNT_TOKEN(token.getTokenType());
+                return token;
+            }
+
+            static Token literalToken(std::string_view word) {
+                if (word == "null")
+                    return Token("null", TokenType::NULL_VAL);
+                if (word == "true")
+                    return Token("true", TokenType::BOOL);
+                if (word == "false")
+                    return Token("false", TokenType::BOOL);
+                throw std::runtime_error("Invalid literal while parsing: " + std::string(word));
+            }
+
+            Token scanNextToken() {
+                while (true) {
+                    std::string_view chunk = reader.currentChunk();
+                    if (chunk.empty()) {
+                        if (cntx == TokenizerContext::LITERAL) {
+                            // A literal running up to the end of input.
+                            cntx = TokenizerContext::NORMAL;
+                            return literalToken(buffer);
+                        }
+                        if (cntx == TokenizerContext::NUMBER && !buffer.empty()) {
+                            // A number running up to the end of input.
+                            cntx = TokenizerContext::NORMAL;
+                            NumberValue number;
+                            if(!NumberParser::parseNumber(buffer, number)){
+                                throw std::runtime_error(std::string("Invalid number format: ") + buffer);
+                            }
+                            return Token(buffer, number);
+                        }
                         return Token("$", TokenType::END_OF_FILE);
                     }
                     switch (cntx) {
                         case TokenizerContext::NORMAL: {
+                            char nextChar = chunk[0];
+                            if (nextChar == '-' || (nextChar >= '0' && nextChar <= '9')) {
+                                // Left unconsumed so the number token can view the chunk.
+                                cntx = TokenizerContext::NUMBER;
+                                buffer.clear();
+                                break;
+                            }
+                            if (isalpha(static_cast<unsigned char>(nextChar))) {
+                                // Collected whole, so a literal cut short by
+                                // a delimiter or the end of input is caught.
+                                cntx = TokenizerContext::LITERAL;
+                                buffer.clear();
+                                break;
+                            }
+                            reader.advance(1);
                             switch (nextChar) {
                                 case '{': return Token("{", TokenType::OPEN_BRACE);
                                 case '[': return Token("[", TokenType::OPEN_BRACK);
@@ -468,85 +1084,71 @@ namespace jsontok{
                                     break;
                                 }
 
-                                case '-': case '0': case '1': case '2': case '3':
-                                case '4': case '5': case '6': case '7': case '8': case '9': {
-                                    cntx = TokenizerContext::NUMBER;
-                                    buffer.clear();
-                                    buffer += nextChar;
-                                    break;
-                                }
-
-                                default: {
-                                    if (!isalpha(nextChar))
-                                        throw std::runtime_error(std::string("Invalid character in JSON: ") + nextChar);
-
-                                    buffer += nextChar;
-                                    if (buffer == "null") {
-                                        buffer.clear();
-                                        return Token("null", TokenType::NULL_VAL);
-                                    }
-                                    if (buffer == "true") {
-                                        buffer.clear();
-                                        return Token("true", TokenType::BOOL);
-                                    }
-                                    if (buffer == "false") {
-                                        buffer.clear();
-                                        return Token("false", TokenType::BOOL);
-                                    }
-                                    if (buffer.size() > 5)
-                                        throw std::runtime_error(std::string("Invalid literal while parsing: ") + buffer);
-                                    break;
-                                }
+                                default:
+                                    throw std::runtime_error(std::string("Invalid character in JSON: ") + nextChar);
                             }
                             break;
                         }
 
                         case TokenizerContext::STRING: {
-                            switch (nextChar) {
-                                case '\\': {
-                                    isEscape = !isEscape;
-                                    buffer += '\\';
-                                    break;
-                                }
-                                case '\"': {
-                                    if (!isEscape) {
-                                        cntx = TokenizerContext::NORMAL;
-                                        std::string val = buffer;
-                                        buffer.clear();
-                                        return Token(val, TokenType::STRING);
-                                    } else {
-                                        buffer += '\"';
-                                        isEscape = false;
-                                    }
-                                    break;
-                                }
-                                default: {
-                                    buffer += nextChar;
-                                    isEscape = false;
-                                    break;
-                                }
+                            size_t end = findStringEnd(chunk, isEscape);
+                            if (end == std::string_view::npos) {
+                                buffer.append(chunk.data(), chunk.size());
+                                reader.advance(chunk.size());
+                                break;
                             }
-                            break;
+                            reader.advance(end + 1);
+                            cntx = TokenizerContext::NORMAL;
+                            if (buffer.empty()) {
+                                return Token(chunk.substr(0, end), TokenType::STRING);
+                            }
+                            buffer.append(chunk.data(), end);
+                            return Token(buffer, TokenType::STRING);
                         }
 
                         case TokenizerContext::NUMBER: {
-                            if (isdigit(nextChar) || nextChar == '.' || nextChar == 'e' || nextChar == 'E' ||
-                                nextChar == '+' || nextChar == '-') {
-                                buffer += nextChar;
-                            } else {
-                                if(!NumberParser::isRealNum(buffer)){
-                                    throw std::runtime_error(std::string("Invalid number format: ") + buffer);
-                                }
-                                std::string val = buffer;
-                                buffer.clear();
-                                cntx = TokenizerContext::NORMAL;
-                                
-                                unProcessed = nextChar;
-                                unProcessedCharPresent = true;
+                            size_t end = 0;
+                            while (end < chunk.size() && isNumberChar(chunk[end])) {
+                                end++;
+                            }
+                            if (end == chunk.size()) {
+                                buffer.append(chunk.data(), chunk.size());
+                                reader.advance(chunk.size());
+                                break;
+                            }
+                            reader.advance(end);
+                            cntx = TokenizerContext::NORMAL;
+                            std::string_view val = chunk.substr(0, end);
+                            if (!buffer.empty()) {
+                                buffer.append(chunk.data(), end);
+                                val = buffer;
+                            }
+                            NumberValue number;
+                            if(!NumberParser::parseNumber(val, number)){
+                                throw std::runtime_error(std::string("Invalid number format: ") + std::string(val));
+                            }
+                            return Token(val, number);
+                        }
 
-                                return Token(val, TokenType::NUMBER);
+                        case TokenizerContext::LITERAL: {
+                            size_t end = 0;
+                            while (end < chunk.size() && isalpha(static_cast<unsigned char>(chunk[end]))) {
+                                end++;
                             }
-                            break;
+                            if (end == chunk.size()) {
+                                buffer.append(chunk.data(), chunk.size());
+                                reader.advance(chunk.size());
+                                if (buffer.size() > 5)
+                                    throw std::runtime_error(std::string("Invalid literal while parsing: ") + buffer);
+                                break;
+                            }
+                            reader.advance(end);
+                            cntx = TokenizerContext::NORMAL;
+                            if (buffer.empty()) {
+                                return literalToken(chunk.substr(0, end));
+                            }
+                            buffer.append(chunk.data(), end);
+                            return literalToken(buffer);
                         }
                     }
                 }
@@ -556,8 +1158,13 @@ namespace jsontok{
 
         public:
             
+            // Token views are valid until the tokenizer is advanced past the
+            // token (the next getNextToken()/peekNextToken() that reads input).
             JsonOnDemandTokenizer(std::string fileName) : reader(fileName) {}
 
+            // Tokenizes size bytes at data, which must outlive the tokenizer.
+            JsonOnDemandTokenizer(const char* data, size_t size) : reader(data, size) {}
+
             Token peekNextToken(){
                 if(shouldConsume){
                     peek = processNextToken();
@@ -574,6 +1181,141 @@ namespace jsontok{
                 return processNextToken();
                 
             }
+
+            // Consumes the next value whole. Containers are skipped by
+            // counting brackets over the raw input, so nothing inside them is
+            // tokenized, converted or copied.
+            void skipValue(){
+                Token first = getNextToken();
+                switch(first.getTokenType()){
+                    case TokenType::OPEN_BRACE:
+                    case TokenType::OPEN_BRACK:
+                        skipContainer();
+                        return;
+                    case TokenType::STRING:
+                    case TokenType::NUMBER:
+                    case TokenType::BOOL:
+                    case TokenType::NULL_VAL:
+                        return;
+                    default:
+                        throw std::runtime_error(std::string("Expected a value, found: ") + std::string(first.getRawTokenValue()));
+                }
+            }
+
+            // The whole input for mapped and in-memory input, which is what a
+            // StructuralIndex for useIndex() is built over; empty when the
+            // input is streamed.
+            std::string_view wholeInput() const{
+                return reader.wholeInput();
+            }
+
+            // Lets skipContainer() and skipElements() jump through an index
+            // of this tokenizer's input instead of scanning it. Only mapped and
+            // in-memory input can be indexed; pass nullptr to stop using it.
+            void useIndex(const jsonindex::StructuralIndex* index){
+                if(index){
+                    std::string_view whole = reader.wholeInput();
+                    if(whole.data() != index->text().data() || whole.size() != index->text().size()){
+                        throw std::runtime_error("The structural index was not built over this tokenizer's input");
+                    }
+                }
+                structure = index;
+            }
+
+            bool hasIndex() const{
+                return structure != nullptr;
+            }
+
+            // Inside an array, just after its '[' or a ',', skips up to count
+            // elements without tokenizing them and returns how many it skipped.
+            // The read position ends at the start of the next element, or
+            // before the ']' if the array ran out first. Needs an index (see
+            // useIndex()); without one, or with a token peeked, skips nothing.
+            // A few binary searches, however many elements are skipped.
+            size_t skipElements(size_t count){
+                if(!structure || !shouldConsume || count == 0){
+                    return 0;
+                }
+                size_t pos = reader.position();
+                size_t entry = structure->find(pos);
+                if(entry == 0){
+                    return 0;
+                }
+                size_t separator = entry - 1;
+                size_t opener = structure->character(separator) == '[' ? separator : structure->container(separator);
+                if(opener == jsonindex::StructuralIndex::NONE || structure->character(opener) != '['){
+                    return 0;
+                }
+                jsonindex::StructuralIndex::SeparatorRun run = structure->separatorsOf(opener);
+                // Elements before the read position: one per ',' passed.
+                size_t passed = separator == opener ? 0 :
+                    static_cast<size_t>(std::lower_bound(run.entries, run.entries + run.count, separator) - run.entries) + 1;
+                if(passed + count <= run.count){
+                    reader.advance(structure->offset(run.entries[passed + count - 1]) + 1 - pos);
+                    return count;
+                }
+                size_t closer = structure->matching(opener);
+                // The rest of the elements, unless the array is empty.
+                size_t left = run.count + 1 - passed;
+                if(run.count == 0 && isBlank(structure->offset(opener) + 1, structure->offset(closer))){
+                    left = 0;
+                }
+                reader.advance(structure->offset(closer) - pos);
+                return left;
+            }
+
+            // Consumes input up to and including the bracket that closes the
+            // container whose opening bracket was the last token read.
+            void skipContainer(){
+                if(structure){
+                    skipContainerIndexed();
+                    return;
+                }
+                size_t depth = 1;
+                bool inString = false;
+                bool stringEscape = false;
+                if(!shouldConsume){
+                    shouldConsume = true;
+                    TokenType type = peek.getTokenType();
+                    if(type == TokenType::OPEN_BRACE || type == TokenType::OPEN_BRACK){
+                        depth++;
+                    }
+                    else if(type == TokenType::CLOSE_BRACE || type == TokenType::CLOSE_BRACK){
+                        return;
+                    }
+                }
+                while(true){
+                    std::string_view chunk = reader.currentChunk();
+                    if(chunk.empty()){
+                        throw std::runtime_error("Unexpected end of input inside a container");
+                    }
+                    size_t pos = 0;
+                    while(pos < chunk.size()){
+                        if(inString){
+                            size_t end = findStringEnd(chunk.substr(pos), stringEscape);
+                            if(end == std::string_view::npos){
+                                pos = chunk.size();
+                                break;
+                            }
+                            pos += end + 1;
+                            inString = false;
+                            continue;
+                        }
+                        char ch = chunk[pos++];
+                        if(ch == '\"'){
+                            inString = true;
+                        }
+                        else if(ch == '{' || ch == '['){
+                            depth++;
+                        }
+                        else if((ch == '}' || ch == ']') && --depth == 0){
+                            reader.advance(pos);
+                            return;
+                        }
+                    }
+                    reader.advance(chunk.size());
+                }
+            }
             
         
     };
@@ -0,0 +1,375 @@
+#pragma once
+#include "jsondom.hpp"
+#include "jsonfmt.hpp"
+#include "jsonparse.hpp"
+#include "jsonsimd.hpp"
+#include "jsontok.hpp"
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace jsonwrite {
+
+    // Room formatNumber needs: sign, 17 significant digits, point and exponent.
+    static const size_t NUMBER_BUFFER_SIZE = 32;
+
+    // Plain decimals with few fractional digits (coordinates, prices,
+    // metrics). Finds the fewest fractional digits k for which m / 10^k reads
+    // back as value; with m below 2^53 that division is exactly the parser's
+    // correctly rounded fast path, so the text round-trips. Below 10^15 no
+    // two such m share a double, and in the range accepted here it is also
+    // what std::to_chars would print. Returns 0 when the value is not such a
+    // decimal.
+    inline size_t formatShortDecimal(double value, char* out) {
+        static const double powersOfTen[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17
+        };
+        const double limit = 1e15;
+        double magnitude = std::fabs(value);
+        if (!(magnitude >= 1e-3 && magnitude < limit) || magnitude == std::floor(magnitude))
+            return 0;
+        for (int k = 1; k <= 17; k++) {
+            double scaled = magnitude * powersOfTen[k];
+            if (scaled >= limit)
+                return 0;
+            uint64_t digits = static_cast<uint64_t>(scaled + 0.5);
+            if (static_cast<double>(digits) / powersOfTen[k] != magnitude)
+                continue;
+            char text[24];
+            char* end = std::to_chars(text, text + sizeof(text), digits).ptr;
+            size_t count = static_cast<size_t>(end - text);
+            char* p = out;
+            if (value < 0)
+                *p++ = '-';
+            if (count <= static_cast<size_t>(k)) {
+                *p++ = '0';
+                *p++ = '.';
+                for (size_t zeros = k - count; zeros > 0; zeros--)
+                    *p++ = '0';
+                std::memcpy(p, text, count);
+                p += count;
+            }
+            else {
+                size_t whole = count - k;
+                std::memcpy(p, text, whole);
+                p += whole;
+                *p++ = '.';
+                std::memcpy(p, text + whole, k);
+                p += k;
+            }
+            return static_cast<size_t>(p - out);
+        }
+        return 0;
+    }
+
+    // Shortest text that reads back as the same value (std::to_chars, which
+    // is Ryu-based in current standard libraries). JSON has no spelling for
+    // infinities or NaN, so those are written as null.
+    inline size_t formatNumber(const jsontok::NumberValue& number, char* out) {
+        std::to_chars_result result;
+        switch (number.getKind()) {
+            case jsontok::NumberKind::INT64:
+                result = std::to_chars(out, out + NUMBER_BUFFER_SIZE, number.asInt64());
+                break;
+            case jsontok::NumberKind::UINT64:
+                result = std::to_chars(out, out + NUMBER_BUFFER_SIZE, number.asUint64());
+                break;
+            default: {
+                double value = number.asDouble();
+                if (!std::isfinite(value)) {
+                    std::memcpy(out, "null", 4);
+                    return 4;
+                }
+                if (size_t len = formatShortDecimal(value, out))
+                    return len;
+                result = std::to_chars(out, out + NUMBER_BUFFER_SIZE, value);
+            }
+        }
+        return static_cast<size_t>(result.ptr - out);
+    }
+
+    template <typename Out>
+    void writeControlEscape(char ch, Out& out) {
+        static const char hex[] = "0123456789abcdef";
+        switch (ch) {
+            case '\b': out.write("\\b", 2); return;
+            case '\f': out.write("\\f", 2); return;
+            case '\n': out.write("\\n", 2); return;
+            case '\r': out.write("\\r", 2); return;
+            case '\t': out.write("\\t", 2); return;
+            default: {
+                char escape[6] = {'\\', 'u', '0', '0', hex[(ch >> 4) & 0xF], hex[ch & 0xF]};
+                out.write(escape, 6);
+            }
+        }
+    }
+
+    // Length of the escape sequence at p (which holds '\\'), or 0 if the
+    // bytes there do not form a valid one.
+    inline size_t escapeLength(const char* p, size_t len) {
+        if (len < 2)
+            return 0;
+        switch (p[1]) {
+            case '\"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                return 2;
+            case 'u':
+                if (len < 6)
+                    return 0;
+                for (size_t i = 2; i < 6; i++)
+                    if (!std::isxdigit(static_cast<unsigned char>(p[i])))
+                        return 0;
+                return 6;
+            default:
+                return 0;
+        }
+    }
+
+    // Writes a string body as the trees hold it: raw text whose escape
+    // sequences are already JSON and are copied through whole. Whatever
+    // would not read back as a string body, as text put into a tree by hand
+    // may contain, is escaped: control characters, a bare '"' and a '\\'
+    // that starts no valid escape sequence.
+    template <typename Out>
+    void writeRaw(std::string_view raw, Out& out) {
+        const char* data = raw.data();
+        size_t len = raw.size();
+        while (len > 0) {
+            size_t run = jsonsimd::findEscapable(data, len);
+            if (run > 0)
+                out.write(data, run);
+            if (run == len)
+                return;
+            char ch = data[run];
+            size_t escape = ch == '\\' ? escapeLength(data + run, len - run) : 0;
+            if (escape > 0)
+                out.write(data + run, escape);
+            else if (ch == '\"' || ch == '\\') {
+                out.pushChar('\\');
+                out.pushChar(ch);
+                escape = 1;
+            }
+            else {
+                writeControlEscape(ch, out);
+                escape = 1;
+            }
+            data += run + escape;
+            len -= run + escape;
+        }
+    }
+
+    // Small-write buffer in front of a writer: tokens are appended with plain
+    // stores and reach the writer in STAGING_SIZE pieces.
+    template <typename Out>
+    class StagedWriter {
+    private:
+        static const size_t STAGING_SIZE = 1 << 16;
+        Out& out;
+        std::unique_ptr<char[]> buffer;
+        size_t used = 0;
+
+    public:
+        StagedWriter(Out& target) : out(target), buffer(new char[STAGING_SIZE]) {}
+        StagedWriter(const StagedWriter&) = delete;
+        StagedWriter& operator=(const StagedWriter&) = delete;
+
+        ~StagedWriter() {
+            flush();
+        }
+
+        void pushChar(char ch) {
+            if (used == STAGING_SIZE)
+                flush();
+            buffer[used++] = ch;
+        }
+
+        void write(const char* data, size_t len) {
+            if (used + len > STAGING_SIZE) {
+                flush();
+                if (len > STAGING_SIZE / 2) {
+                    out.write(data, len);
+                    return;
+                }
+            }
+            std::memcpy(buffer.get() + used, data, len);
+            used += len;
+        }
+
+        void write(std::string_view text) {
+            write(text.data(), text.size());
+        }
+
+        void flush() {
+            if (used > 0) {
+                out.write(buffer.get(), used);
+                used = 0;
+            }
+        }
+    };
+
+    // Writes a value tree back out as JSON text, into any writer with the
+    // OutputFileWriter/BufferWriter pushChar/write surface. Compact when
+    // indent < 0; otherwise laid out like JsonFormat::formatJson(indent),
+    // except that empty containers stay {} and [].
+    template <typename Out>
+    class Serializer {
+    private:
+        StagedWriter<Out> out;
+        bool pretty;
+        jsonfmt::IndentTable indentTable;
+
+        void newLine(long level) {
+            if (pretty)
+                out.write(indentTable.newLine(level));
+        }
+
+        void writeString(std::string_view raw) {
+            out.pushChar('\"');
+            writeRaw(raw, out);
+            out.pushChar('\"');
+        }
+
+        void writeKey(std::string_view raw) {
+            writeString(raw);
+            if (pretty)
+                out.write(": ", 2);
+            else
+                out.pushChar(':');
+        }
+
+        void writeNumber(const jsontok::NumberValue& number) {
+            char text[NUMBER_BUFFER_SIZE];
+            out.write(text, formatNumber(number, text));
+        }
+
+        void writeLiteral(jsonparse::LiteralType type, bool flag) {
+            switch (type) {
+                case jsonparse::LiteralType::BOOL:
+                    if (flag)
+                        out.write("true", 4);
+                    else
+                        out.write("false", 5);
+                    break;
+                default:
+                    out.write("null", 4);
+            }
+        }
+
+
+        void writeValue(const jsonparse::JPtr& value, long level) {
+            switch (value->getObjType()) {
+                case jsonparse::JsonObjectType::OBJECT: {
+                    const auto& pairs = static_cast<const jsonparse::JsonObject*>(value.get())->getKeyPairs();
+                    out.pushChar('{');
+                    for (size_t i = 0; i < pairs.size(); i++) {
+                        if (i > 0)
+                            out.pushChar(',');
+                        newLine(level + 1);
+                        writeKey(pairs[i].first);
+                        writeValue(pairs[i].second, level + 1);
+                    }
+                    if (!pairs.empty())
+                        newLine(level);
+                    out.pushChar('}');
+                    break;
+                }
+                case jsonparse::JsonObjectType::ARRAY: {
+                    const auto& values = static_cast<const jsonparse::JsonArray*>(value.get())->getArrayVals();
+                    out.pushChar('[');
+                    for (size_t i = 0; i < values.size(); i++) {
+                        if (i > 0)
+                            out.pushChar(',');
+                        newLine(level + 1);
+                        writeValue(values[i], level + 1);
+                    }
+                    if (!values.empty())
+                        newLine(level);
+                    out.pushChar(']');
+                    break;
+                }
+                default: {
+                    auto literal = static_cast<const jsonparse::JsonLiteral*>(value.get());
+                    switch (literal->getLiteralType()) {
+                        case jsonparse::LiteralType::STRING:
+                            writeString(static_cast<const jsonparse::JsonString*>(literal)->getValue());
+                            break;
+                        case jsonparse::LiteralType::NUMBER:
+                            writeNumber(static_cast<const jsonparse::JsonNumber*>(literal)->getNumberValue());
+                            break;
+                        case jsonparse::LiteralType::BOOL:
+                            writeLiteral(jsonparse::LiteralType::BOOL,
+                                         static_cast<const jsonparse::JsonBool*>(literal)->getValue());
+                            break;
+                        default:
+                            writeLiteral(jsonparse::LiteralType::NULL_VAL, false);
+                    }
+                }
+            }
+        }
+
+        void writeValue(const jsondom::Document& doc, const jsondom::Node& node, long level) {
+            switch (node.getObjType()) {
+                case jsonparse::JsonObjectType::OBJECT: {
+                    const jsondom::Node* member = doc.children(node);
+                    out.pushChar('{');
+                    for (uint64_t i = 0; i < node.length; i++, member += 2) {
+                        if (i > 0)
+                            out.pushChar(',');
+                        newLine(level + 1);
+                        writeKey(doc.getString(member[0]));
+                        writeValue(doc, member[1], level + 1);
+                    }
+                    if (node.length > 0)
+                        newLine(level);
+                    out.pushChar('}');
+                    break;
+                }
+                case jsonparse::JsonObjectType::ARRAY: {
+                    const jsondom::Node* element = doc.children(node);
+                    out.pushChar('[');
+                    for (uint64_t i = 0; i < node.length; i++) {
+                        if (i > 0)
+                            out.pushChar(',');
+                        newLine(level + 1);
+                        writeValue(doc, element[i], level + 1);
+                    }
+                    if (node.length > 0)
+                        newLine(level);
+                    out.pushChar(']');
+                    break;
+                }
+                default:
+                    switch (node.getLiteralType()) {
+                        case jsonparse::LiteralType::STRING:
+                            writeString(doc.getString(node));
+                            break;
+                        case jsonparse::LiteralType::NUMBER:
+                            writeNumber(doc.getNumber(node));
+                            break;
+                        default:
+                            writeLiteral(node.getLiteralType(), doc.getBool(node));
+                    }
+            }
+        }
+
+    public:
+        Serializer(Out& target, int indent = -1)
+            : out(target), pretty(indent >= 0), indentTable(indent) {}
+
+        // Each call writes one complete value and hands it to the target.
+        void write(const jsonparse::JPtr& value) {
+            writeValue(value, 0);
+            out.flush();
+        }
+
+        void write(const jsondom::Document& doc, const jsondom::Node& node) {
+            writeValue(doc, node, 0);
+            out.flush();
+        }
+    };
+}
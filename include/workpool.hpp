@@ -0,0 +1,147 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace workpool {
+
+    // Fixed set of worker threads, each with its own task deque. Submitted
+    // tasks are dealt round-robin; a worker takes from the back of its own
+    // deque and, once that is empty, steals from the front of the others, so
+    // a few long tasks (large files) do not leave the other workers idle.
+    class WorkStealingPool {
+    public:
+        using Task = std::function<void()>;
+
+    private:
+        struct Queue {
+            std::mutex lock;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread> workers;
+
+        std::mutex stateLock;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        std::atomic<size_t> available{0}; // tasks sitting in the deques
+        size_t unfinished = 0;            // submitted and not yet finished
+        size_t nextQueue = 0;
+        bool stopping = false;
+        std::exception_ptr firstError;
+
+        bool popOwn(size_t index, Task& task) {
+            Queue& queue = *queues[index];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (queue.tasks.empty())
+                return false;
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            available--;
+            return true;
+        }
+
+        bool steal(size_t index, Task& task) {
+            for (size_t offset = 1; offset < queues.size(); offset++) {
+                Queue& queue = *queues[(index + offset) % queues.size()];
+                std::lock_guard<std::mutex> guard(queue.lock);
+                if (queue.tasks.empty())
+                    continue;
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                available--;
+                return true;
+            }
+            return false;
+        }
+
+        void workerLoop(size_t index) {
+            while (true) {
+                Task task;
+                if (popOwn(index, task) || steal(index, task)) {
+                    try {
+                        task();
+                    }
+                    catch (...) {
+                        std::lock_guard<std::mutex> guard(stateLock);
+                        if (!firstError)
+                            firstError = std::current_exception();
+                    }
+                    std::lock_guard<std::mutex> guard(stateLock);
+                    if (--unfinished == 0)
+                        idle.notify_all();
+                    continue;
+                }
+                std::unique_lock<std::mutex> guard(stateLock);
+                wake.wait(guard, [&]() { return stopping || available > 0; });
+                if (stopping && available == 0)
+                    return;
+            }
+        }
+
+    public:
+        // threads == 0 uses one worker per hardware thread.
+        explicit WorkStealingPool(unsigned threads = 0) {
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            for (unsigned i = 0; i < threads; i++)
+                queues.push_back(std::make_unique<Queue>());
+            for (unsigned i = 0; i < threads; i++)
+                workers.emplace_back([this, i]() { workerLoop(i); });
+        }
+
+        WorkStealingPool(const WorkStealingPool&) = delete;
+        WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+        ~WorkStealingPool() {
+            {
+                std::lock_guard<std::mutex> guard(stateLock);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto& worker : workers)
+                worker.join();
+        }
+
+        size_t size() const {
+            return workers.size();
+        }
+
+        void submit(Task task) {
+            size_t index;
+            {
+                // Counted under stateLock, before the push, so a worker about
+                // to sleep sees it and the count never drops below zero.
+                std::lock_guard<std::mutex> guard(stateLock);
+                index = nextQueue++ % queues.size();
+                unfinished++;
+                available++;
+            }
+            {
+                std::lock_guard<std::mutex> guard(queues[index]->lock);
+                queues[index]->tasks.push_back(std::move(task));
+            }
+            wake.notify_one();
+        }
+
+        // Blocks until every submitted task has finished, then rethrows the
+        // first exception a task raised, if any.
+        void wait() {
+            std::unique_lock<std::mutex> guard(stateLock);
+            idle.wait(guard, [&]() { return unfinished == 0; });
+            if (firstError) {
+                std::exception_ptr error = firstError;
+                firstError = nullptr;
+                std::rethrow_exception(error);
+            }
+        }
+    };
+}
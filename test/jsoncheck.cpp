@@ -0,0 +1,455 @@
+// Differential checks against simple reference implementations.
+//
+//   g++ -O2 -std=c++17 -pthread -Iinclude test/jsoncheck.cpp -o jsoncheck
+//   ./jsoncheck [--size MiB] [--seed N] [--dir scratchDir]
+//
+// Generates inputs larger than the parallel chunk size and checks that
+// formatJson, minifyJson and their parallel versions produce byte for byte
+// what a character-at-a-time reference produces, that the structural index
+// finds and pairs the same brackets as a plain scan, and that numbers read
+// back exactly after formatNumber. Also runs column extraction over records
+// where one path matches several values, and dumps a hand-built tree whose
+// strings are not valid JSON string bodies. Prints each failure and exits non-zero if
+// there was any.
+#include "json.hpp"
+#include "jsoncolumns.hpp"
+#include "jsonfmt.hpp"
+#include "jsonindex.hpp"
+#include "jsontok.hpp"
+#include "jsonwrite.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+static int failures = 0;
+
+static void fail(const std::string& what) {
+    std::printf("FAIL %s\n", what.c_str());
+    failures++;
+}
+
+// Random JSON with uneven whitespace, strings full of escapes and
+// structural characters, and runs of deep nesting, so chunk and block
+// boundaries land in every kind of context.
+class Generator {
+public:
+    explicit Generator(uint64_t seed) : rng(seed) {}
+
+    std::string document(size_t minBytes) {
+        out.clear();
+        out += "[";
+        bool first = true;
+        while (out.size() < minBytes) {
+            if (!first)
+                out += ',';
+            first = false;
+            space();
+            value(0);
+        }
+        space();
+        out += "]\n";
+        return out;
+    }
+
+    // One string value longer than `bytes`, so that a whole chunk lies
+    // inside it.
+    std::string longString(size_t bytes) {
+        out = "{\"before\": [1, 2], \"long\": \"";
+        while (out.size() < bytes) {
+            out += "text {[,:]} \\\" \\\\ ";
+            out += static_cast<char>('a' + pick(26));
+        }
+        out += "\", \"after\": {\"x\": [true, null]}}\n";
+        return out;
+    }
+
+private:
+    std::mt19937_64 rng;
+    std::string out;
+
+    size_t pick(size_t n) { return static_cast<size_t>(rng() % n); }
+
+    void space() {
+        static const char blanks[] = {' ', '\n', '\t'};
+        size_t n = pick(4) == 0 ? pick(6) : 0;
+        for (size_t i = 0; i < n; i++)
+            out += blanks[pick(3)];
+    }
+
+    void string() {
+        static const char* pieces[] = {"a", "key", " ", "\\\"", "\\\\", "\\n", "\\u00e9", "{", "}", "[", "]", ":",
+                                       ",", "\t", "\xc3\xa9", "\\/"};
+        out += '"';
+        size_t n = pick(8) == 0 ? 40 + pick(200) : pick(12);
+        for (size_t i = 0; i < n; i++)
+            out += pieces[pick(sizeof(pieces) / sizeof(pieces[0]))];
+        out += '"';
+    }
+
+    void value(int depth) {
+        size_t kind = depth > 12 ? pick(5) : pick(8);
+        if (depth < 40 && pick(200) == 0)
+            kind = 5 + pick(2);
+        switch (kind) {
+            case 0: out += std::to_string(static_cast<int64_t>(rng()) >> pick(64)); break;
+            case 1: {
+                char buffer[32];
+                std::snprintf(buffer, sizeof(buffer), "%.*g", static_cast<int>(1 + pick(17)),
+                              std::ldexp(static_cast<double>(rng() >> 11), static_cast<int>(pick(80)) - 60));
+                out += buffer;
+                break;
+            }
+            case 2: string(); break;
+            case 3: out += pick(2) ? "true" : "false"; break;
+            case 4: out += "null"; break;
+            case 5: case 7: {
+                out += '{';
+                size_t n = pick(6);
+                for (size_t i = 0; i < n; i++) {
+                    if (i)
+                        out += ',';
+                    space();
+                    string();
+                    space();
+                    out += ':';
+                    space();
+                    value(depth + 1);
+                    space();
+                }
+                out += '}';
+                break;
+            }
+            default: {
+                out += '[';
+                size_t n = pick(6);
+                for (size_t i = 0; i < n; i++) {
+                    if (i)
+                        out += ',';
+                    space();
+                    value(depth + 1);
+                    space();
+                }
+                out += ']';
+            }
+        }
+    }
+};
+
+// The original formatter, one character at a time.
+static std::string referenceFormat(const std::string& input, int indent) {
+    std::string out;
+    long level = 0;
+    bool newLine = false, inString = false, escaped = false;
+    auto indentLine = [&]() {
+        if (newLine) {
+            newLine = false;
+            out.append(static_cast<size_t>(level * indent), ' ');
+        }
+    };
+    for (char ch : input) {
+        if (inString) {
+            out += ch;
+            if (escaped)
+                escaped = false;
+            else if (ch == '\\')
+                escaped = true;
+            else if (ch == '"')
+                inString = false;
+            continue;
+        }
+        switch (ch) {
+            case '{': case '[':
+                indentLine();
+                out += ch;
+                out += '\n';
+                newLine = true;
+                level++;
+                break;
+            case '}': case ']':
+                out += '\n';
+                level--;
+                out.append(static_cast<size_t>(level * indent), ' ');
+                out += ch;
+                break;
+            case ':': out += ": "; break;
+            case ',':
+                out += ",\n";
+                newLine = true;
+                break;
+            case ' ': case '\n': case '\t': break;
+            default:
+                if (ch == '"')
+                    inString = true;
+                indentLine();
+                out += ch;
+        }
+    }
+    return out;
+}
+
+static std::string referenceMinify(const std::string& input) {
+    std::string out;
+    bool inString = false, escaped = false;
+    for (char ch : input) {
+        if (inString) {
+            if (escaped)
+                escaped = false;
+            else if (ch == '\\')
+                escaped = true;
+            else if (ch == '"')
+                inString = false;
+        }
+        else if (ch == '"')
+            inString = true;
+        else if (ch == ' ' || ch == '\n' || ch == '\t')
+            continue;
+        out += ch;
+    }
+    return out;
+}
+
+static void writeFile(const std::string& path, const std::string& text) {
+    std::ofstream(path, std::ios::binary).write(text.data(), static_cast<std::streamsize>(text.size()));
+}
+
+static std::string readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::ostringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+static void checkFormatting(const std::string& name, const std::string& input, const std::string& dir) {
+    std::string inPath = dir + "/in.json", outPath = dir + "/out.json";
+    writeFile(inPath, input);
+    std::string minified = referenceMinify(input);
+    auto compare = [&](const std::string& what, const std::string& expected) {
+        std::string actual = readFile(outPath);
+        if (actual == expected)
+            return;
+        size_t at = 0;
+        while (at < actual.size() && at < expected.size() && actual[at] == expected[at])
+            at++;
+        fail(name + ": " + what + " differs from the reference at byte " + std::to_string(at));
+    };
+    for (int indent : {4, 2, 0}) {
+        std::string formatted = referenceFormat(input, indent);
+        jsonfmt::JsonFormat(inPath, outPath).formatJson(indent);
+        compare("formatJson(" + std::to_string(indent) + ")", formatted);
+        for (unsigned threads : {2u, 3u, 8u}) {
+            jsonfmt::JsonFormat(inPath, outPath).formatJsonParallel(indent, threads);
+            compare("formatJsonParallel(" + std::to_string(indent) + ", " + std::to_string(threads) + ")", formatted);
+        }
+    }
+    jsonfmt::JsonFormat(inPath, outPath).minifyJson();
+    compare("minifyJson", minified);
+    for (unsigned threads : {2u, 3u, 8u}) {
+        jsonfmt::JsonFormat(inPath, outPath).minifyJsonParallel(threads);
+        compare("minifyJsonParallel(" + std::to_string(threads) + ")", minified);
+    }
+    std::remove(inPath.c_str());
+    std::remove(outPath.c_str());
+}
+
+static void checkIndex(const std::string& name, const std::string& input) {
+    jsonindex::StructuralIndex index(input);
+    std::vector<size_t> offsets, open, matching;
+    bool inString = false, escaped = false;
+    for (size_t i = 0; i < input.size(); i++) {
+        char ch = input[i];
+        if (inString) {
+            if (escaped)
+                escaped = false;
+            else if (ch == '\\')
+                escaped = true;
+            else if (ch == '"')
+                inString = false;
+            continue;
+        }
+        if (ch == '"')
+            inString = true;
+        if (!std::strchr("{}[]:,", ch) || ch == '\0')
+            continue;
+        matching.push_back(jsonindex::StructuralIndex::NONE);
+        if (ch == '{' || ch == '[')
+            open.push_back(offsets.size());
+        else if (ch == '}' || ch == ']') {
+            matching[open.back()] = offsets.size();
+            matching.back() = open.back();
+            open.pop_back();
+        }
+        offsets.push_back(i);
+    }
+    if (index.size() != offsets.size()) {
+        fail(name + ": index has " + std::to_string(index.size()) + " entries, expected " +
+             std::to_string(offsets.size()));
+        return;
+    }
+    for (size_t entry = 0; entry < offsets.size(); entry++) {
+        if (index.offset(entry) != offsets[entry]) {
+            fail(name + ": index entry " + std::to_string(entry) + " is at byte " + std::to_string(index.offset(entry)) +
+                 ", expected " + std::to_string(offsets[entry]));
+            return;
+        }
+        if ((index.isOpener(entry) || index.isCloser(entry)) && index.matching(entry) != matching[entry]) {
+            fail(name + ": index entry " + std::to_string(entry) + " is paired wrongly");
+            return;
+        }
+    }
+}
+
+// Each case is one column over two records; the first value a path
+// matches counts and the rest of the record is skipped whole.
+static void checkColumns(const std::string& dir) {
+    struct Case {
+        const char* input;
+        jsoncolumns::ColumnSpec spec;
+        const char* first;
+    };
+    const Case cases[] = {
+        {"[{\"a\":1,\"b\":{\"c\":2}}, {\"a\":7}]", {"/*", jsoncolumns::ColumnType::INT64}, "1"},
+        {"[{\"a\":1,\"a\":{\"x\":1}}, {\"a\":7}]", {"/a", jsoncolumns::ColumnType::INT64}, "1"},
+        {"[{\"a\":\"s\",\"a\":[1,2]}, {\"a\":\"t\"}]", {"/a", jsoncolumns::ColumnType::STRING}, "s"},
+        {"[[1,[2,3],{\"x\":4}], [7]]", {"/*", jsoncolumns::ColumnType::INT64}, "1"},
+    };
+    std::string path = dir + "/records.json";
+    for (const Case& c : cases) {
+        writeFile(path, c.input);
+        try {
+            jsoncolumns::ColumnSet set = jsoncolumns::extractRecords(path, {c.spec});
+            const jsoncolumns::Column& column = set.column(0);
+            std::string first = c.spec.type == jsoncolumns::ColumnType::STRING
+                ? column.dictionary()[column.codes()[0]]
+                : std::to_string(column.int64s()[0]);
+            if (set.rowCount() != 2 || column.isNull(1) || first != c.first)
+                fail(std::string("columns: wrong values from ") + c.input);
+        }
+        catch (const std::exception& e) {
+            fail(std::string("columns: ") + c.input + ": " + e.what());
+        }
+    }
+    std::remove(path.c_str());
+}
+
+// Strings set by hand are escaped as needed; raw escape sequences from
+// the input go through as they are.
+static void checkSerializer() {
+    auto object = std::make_shared<jsonparse::JsonObject>();
+    object->addKeyPair("q\"k", std::make_shared<jsonparse::JsonString>("say \"hi\"\\"));
+    object->addKeyPair("raw", std::make_shared<jsonparse::JsonString>("tab\\t \\u00e9 \\x \\u12"));
+    object->addKeyPair("line", std::make_shared<jsonparse::JsonString>("a\nb"));
+    std::string text = json::Json(object).dump();
+    const char* expected = "{\"q\\\"k\":\"say \\\"hi\\\"\\\\\",\"raw\":\"tab\\t \\u00e9 \\\\x \\\\u12\","
+                           "\"line\":\"a\\nb\"}";
+    if (text != expected)
+        fail("dump of a hand-built tree: " + text);
+    try {
+        json::Json::parse(text);
+    }
+    catch (const std::exception& e) {
+        fail("dump of a hand-built tree does not parse: " + std::string(e.what()));
+    }
+}
+
+static bool sameNumber(const jsontok::NumberValue& a, const jsontok::NumberValue& b) {
+    if (a.getKind() == b.getKind())
+        return a.getBits() == b.getBits();
+    // An integral double may read back as an integer.
+    return a.getKind() == jsontok::NumberKind::DOUBLE && a.asDouble() == b.asDouble();
+}
+
+static void checkNumber(const jsontok::NumberValue& number) {
+    char buffer[jsonwrite::NUMBER_BUFFER_SIZE];
+    std::string text(buffer, jsonwrite::formatNumber(number, buffer));
+    jsontok::NumberValue back;
+    if (!jsontok::NumberParser::parseNumber(text, back))
+        fail("formatNumber wrote unparseable " + text);
+    else if (!sameNumber(number, back))
+        fail("number " + text + " does not read back as the value written");
+}
+
+static void checkNumbers(uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    for (int i = 0; i < 200000; i++) {
+        uint64_t bits = rng();
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        if (std::isfinite(value))
+            checkNumber(jsontok::NumberValue::fromDouble(value));
+        checkNumber(jsontok::NumberValue::fromDouble(static_cast<double>(rng() % 1000000) / 1000));
+        checkNumber(jsontok::NumberValue::fromDouble(std::ldexp(static_cast<double>(rng() >> 11), static_cast<int>(rng() % 200) - 100)));
+        checkNumber(jsontok::NumberValue::fromInt64(static_cast<int64_t>(rng()) >> (rng() % 64)));
+        checkNumber(jsontok::NumberValue::fromUint64(rng() | (uint64_t(1) << 63)));
+    }
+    for (double value : {0.0, -0.0, 5e-324, 2.2250738585072014e-308, 1.7976931348623157e308, 0.1, 1e21, 1e22,
+                         9007199254740993.0, 123456789012345678.0})
+        checkNumber(jsontok::NumberValue::fromDouble(value));
+
+    // Decimal text converts to the nearest double, as strtod does.
+    for (int i = 0; i < 200000; i++) {
+        std::string text = (rng() & 1) ? "-" : "";
+        size_t digits = 1 + rng() % 25;
+        for (size_t d = 0; d < digits; d++)
+            text += static_cast<char>('0' + (d == 0 ? 1 + rng() % 9 : rng() % 10));
+        if (rng() & 1)
+            text.insert(text.size() - rng() % digits, ".");
+        if (rng() & 1)
+            text += "e" + std::to_string(static_cast<int>(rng() % 700) - 350);
+        if (text.back() == '.')
+            text += '0';
+        jsontok::NumberValue number;
+        if (!jsontok::NumberParser::parseNumber(text, number)) {
+            fail("parseNumber rejected " + text);
+            continue;
+        }
+        double expected = std::strtod(text.c_str(), nullptr);
+        double actual = number.asDouble();
+        if (std::memcmp(&expected, &actual, sizeof(double)) != 0 && !(expected == 0 && actual == 0))
+            fail("parseNumber read " + text + " inexactly");
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t sizeMiB = 10;
+    uint64_t seed = 1;
+    std::string dir = "check-scratch";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        if (flag == "--size")
+            sizeMiB = std::strtoul(argv[i + 1], nullptr, 10);
+        else if (flag == "--seed")
+            seed = std::strtoull(argv[i + 1], nullptr, 10);
+        else if (flag == "--dir")
+            dir = argv[i + 1];
+        else {
+            std::fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+    mkdir(dir.c_str(), 0755);
+
+    Generator generator(seed);
+    std::string mixed = generator.document(sizeMiB << 20);
+    checkFormatting("mixed", mixed, dir);
+    checkIndex("mixed", mixed);
+    std::string longString = generator.longString(9 << 20);
+    checkFormatting("long string", longString, dir);
+    checkIndex("long string", longString);
+    checkNumbers(seed);
+    checkColumns(dir);
+    checkSerializer();
+
+    if (failures != 0) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}